@@ -23,7 +23,8 @@
    - packets can be corrupted (either the header or the data portion)
    or lost, according to user-defined probabilities
    - packets will be delivered in the order in which they were sent
-   (although some can be lost).
+   (although some can be lost), unless reordering is switched on with -r,
+   in which case a packet may overtake others by a random jitter.
 
    Modifications (6/6/2008 - CLP): 
    - removed bidirectional GBN code and other code not used by prac. 
@@ -34,56 +35,345 @@
    - fixed C style to adhere to current programming style
 
    ********************************************************************* */
+#define _POSIX_C_SOURCE 200112L   /* mmap() for replay files */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "emulator.h"
 #include "gbn.h"
+#ifdef ENGINES
+#include "engines.h"   /* the protocol build is picked at startup, see engines.c */
+#endif
+#include "prof.h"
+#ifdef PARALLEL
+#include <pthread.h>
+#define PERTHREAD __thread   /* each side's thread has its own, see runparallel() */
+#else
+#define PERTHREAD
+#endif
 
 struct event {
   float evtime;           /* event time */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
+  int conn;               /* connection the event belongs to */
   struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
-  struct event *prev;
-  struct event *next;
+  int pktno;              /* order in which the packet entered layer 3 */
+  int hop;                /* FROM_ROUTER: the router the packet reaches */
+  int timerid;            /* TIMER_INTERRUPT: id of a named timer, or NOTIMER */
+  int src;                /* side that inserted it, with -i; always A otherwise */
+  unsigned long seq;      /* order in which src inserted it */
+  int heappos;            /* where the event sits in evheap */
+};
+
+/* The pending events, kept as a binary heap so that inserting, removing */
+/* and taking the next event stay cheap with thousands of connections.   */
+/* Events due at the same time come out most recently inserted first,    */
+/* which is the order the original sorted event list gave them.  With -i */
+/* each side counts the events it inserts on its own, so the order does   */
+/* not depend on how the two sides' events are interleaved.  Under -t 2   */
+/* each side's thread has a heap of its own events.                       */
+PERTHREAD struct event **evheap = NULL;
+PERTHREAD int nevents = 0;     /* events in the heap */
+static PERTHREAD int maxevents = 0; /* room in the heap */
+static unsigned long nextseq[2];
+
+#define EVBEFORE(p, q) ((p)->evtime < (q)->evtime || \
+                        ((p)->evtime == (q)->evtime && ((p)->seq > (q)->seq || \
+                          ((p)->seq == (q)->seq && (p)->src > (q)->src))))
+
+/* Messages A has accepted and B not yet delivered, per connection.  The */
+/* sender's window bounds them, so a small ring is enough; -E latency     */
+/* uses it to pair each delivery with the time its message was accepted. */
+#define ACCEPTQ 32
+
+/* per connection state kept by the emulator */
+struct flow {
+  int generated;            /* messages handed to A_output() */
+  int delivered;            /* messages given to tolayer5() */
+  unsigned long bytes;      /* bytes given to tolayer5() */
+  int datasent;             /* packets A gave to tolayer3(), resends included */
+  int pktssent[2];          /* packets sent towards A and towards B */
+  int pktsseen[2];          /* highest pktno delivered at A and at B, plus 1 */
+  struct event *timer[2];   /* running timer of A and of B, if any */
+  struct event **timers[2]; /* their named timers by id, allocated on first use */
+  float accepted[ACCEPTQ];  /* when A_output() took the messages not yet delivered */
+  int accfirst, acccount;   /* oldest of them and how many there are */
+  unsigned long srcpos;     /* next byte of the -I file to send, wrapping at its end */
+  unsigned long srcbytes;   /* bytes of it A_output() accepted */
+  unsigned long rcvhash;    /* hash of the bytes delivered at B ... */
+  unsigned long rcvbytes;   /* ... and how many, warm-up included */
+  double unread;            /* of the bytes delivered at B, those not read by readtime */
+  float readtime;
+  float onuntil;            /* -A onoff: end of the current on period */
+  long arrnext;             /* -A trace: next timestamp to use */
+  int blocked;              /* -A saturate: the message A refused waits for A's next event */
 };
 
-struct event *evlist = NULL;   /* the event list */
+static struct flow *flows;     /* one per connection */
+static int nflows = 1;         /* number of connections, see -n */
 
 /* possible events: */
 #define  TIMER_INTERRUPT 0  
 #define  FROM_LAYER5     1
 #define  FROM_LAYER3     2
+#define  FROM_ROUTER     3     /* a packet reaches a router of the -P path */
 
 #define  OFF             0
 #define  ON              1
 
+/* states of the Gilbert-Elliott channel */
+#define  GOOD            0
+#define  BAD             1
+
+/* loss bursts of 1..BURSTHIST-1 packets are counted individually, */
+/* longer ones all go in the last bucket */
+#define  BURSTHIST       8
+
+/* 32 bit FNV-1a, for checking what B delivered against the -I file */
+#define  FNV_OFFSET      2166136261UL
+#define  FNV_PRIME       16777619UL
+
+/* delivered bytes the -O sink gathers before it writes them out */
+#define  SINKBUF         (1 << 20)
+
+/* metrics that can end a run early, see -E */
+#define  STOP_GOODPUT    1
+#define  STOP_LATENCY    2
+
+/* batches -E needs before it trusts the confidence interval */
+#define  MINBATCHES      10
+
+/* A path of store-and-forward routers between A and B (-P).  A packet */
+/* from tolayer3() reaches the first router on its way, waits its turn  */
+/* in that router's queue, takes service time units to be sent and     */
+/* delay more to reach the next router, or the far end after the last.  */
+/* Every router has a queue for each direction.                         */
+#define  MAXHOPS         16
+#define  MAXQUEUE        256
+
+struct router {
+  float delay;              /* to the next node */
+  float loss;               /* probability a packet is dropped here */
+  int qlimit;               /* packets queued at most, the one being sent included */
+  float service;            /* time units to send one packet */
+};
+
+struct hopqueue {
+  float departs[MAXQUEUE];  /* when the queued packets will have been sent, oldest first */
+  int head, count;
+  int arrived;
+  int resent;               /* of which sent again by A after a timeout */
+  int lost;                 /* dropped with probability loss */
+  int overflowed;           /* dropped because the queue was full */
+  int forwarded;
+  int maxqueue;
+  double queuesum;          /* packets queued ahead of each arrival, for the mean */
+};
+
+/* Traffic generators (-A).  next() gives the time from now until the   */
+/* next message of a connection, negative when it will send no more.     */
+struct generator {
+  char *name;
+  double (*next)(int conn);
+};
+
+/* jitter distributions for reordered packets */
+#define  JITTER_UNIFORM     0
+#define  JITTER_EXPONENTIAL 1
+#define  JITTER_NORMAL      2
+
 int TRACE = 3;
+int mtu = MAXPAYLOAD;     /* payload bytes per packet, see -m */
+int msgsize = 20;         /* bytes per message from layer 5, see -s */
+int fec_k = 0;            /* data packets per parity packet, see -F */
+int retx_mode = RETX_SR;  /* how A resends after a timeout, see -R */
+int window_size;          /* packets in A's window, see -W */
+int nak_holdoff;          /* B NAKs gaps, see -K */
+int flow_control;         /* B's application reads at readrate, see -D */
+int timer_fired = NOTIMER; /* the timer the timerinterrupt being called is for */
 
 /* statistics updated by GBN */
 int window_full;   /* count of the number of messages dropped due to full window */
+int rcv_buffer_max;    /* most packets ever held in the receive buffer at once */
 int total_ACKs_received;
 int packets_resent;       /* count of the number of packets resent  */
 int new_ACKs;           /* count of the number of acks correctly received */
 int packets_received;  /* count of the packets received by receiver */
+int fec_recovered;     /* count of the packets rebuilt from parity by receiver */
+int retx_recovered;    /* count of the packets receiver first got from a resend */
+int mode_switches;     /* count of the sender's GBN/SR strategy changes */
+int unacked_packets;   /* current number of packets awaiting an ACK */
+int buffered_packets;  /* current number of packets held in receive buffers */
+int naks_sent;         /* count of the missing packets named in NAKs */
+int nak_resends;       /* count of the resends a NAK asked for */
+int timeout_resends;   /* count of the resends after a timeout */
+int flow_limited;      /* count of the messages B's advertised window refused */
+int window_probes;     /* count of the zero window probes A sent */
 
-/* statistics updated by emulator */
+/* statistics updated by emulator.  Both sides update the PERTHREAD ones: */
+/* under -t 2 each thread counts its own, and B's are added to A's at the */
+/* end (see runparallel()).                                               */
 static int packets_lost;  
 static int packets_corrupt;
 static int packets_sent;
 static int packets_timeout;
 static int messages_delivered;
+static unsigned long bytes_delivered;
+static PERTHREAD int packets_reordered; /* delivered after a packet sent later */
+static PERTHREAD int packets_expired;   /* lost with -r for outliving MAXLIFETIME */
+static int parity_sent;           /* FEC parity packets handed to layer 3 by A */
+static unsigned long bytes_sentA; /* header and payload bytes handed to layer 3 by A */
+static unsigned long parity_bytes;/* of which in parity packets */
 
 static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
 static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
+static PERTHREAD float simtime = 0.000; /* under -t 2, the time at this thread's side */
 static float lossprob;            /* probability that a packet is dropped  */
 static float corruptprob;   /* probability that one bit is packet is flipped */
 static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
 static float lambda;        /* arrival rate of messages from layer 5 */   
-static int   ntolayer3;           /* number sent into layer 3 */
-static int   nlost;               /* number lost in media */
-static int ncorrupt;              /* number corrupted by media*/
+static PERTHREAD int ntolayer3;   /* number sent into layer 3 */
+static PERTHREAD int nlost;       /* number lost in media */
+static PERTHREAD int ncorrupt;    /* number corrupted by media*/
+static float reorderprob;         /* probability a packet may overtake others, see -r */
+static float jitter = 5.0;        /* mean extra delay of such a packet, see -j */
+static int jitterdist = JITTER_UNIFORM; /* distribution of that delay, see -J */
+static float lastarrival[2];      /* latest arrival scheduled at A and at B */
+static int gilbert;               /* bursty Gilbert-Elliott channel, see -G */
+static float ge_pgb, ge_pbg;      /* per packet P(good->bad) and P(bad->good) */
+static float ge_lossbad;          /* loss probability in the bad state */
+static float ge_corruptbad;       /* corruption probability in the bad state */
+static int gestate[2];            /* channel state seen by packets from A and from B */
+static PERTHREAD int ge_badpkts;  /* packets that met the channel in the bad state */
+static int lossrun[2];            /* current run of lost packets from A and from B */
+static PERTHREAD int nbursts;     /* completed runs of consecutive losses */
+static PERTHREAD int burstmax;    /* longest of them */
+static PERTHREAD int bursthist[BURSTHIST]; /* histogram of their lengths */
+static char *replayfile;          /* channel decisions come from here, see -T */
+static int replayloop;            /* start over at the end rather than stop */
+static struct replayrec *replay;  /* the mapped records */
+static long nreplay;              /* how many there are */
+static long replaynext;           /* the next one to use */
+static long replayused;           /* records used, counting every loop */
+static int replayended;           /* ran out of records, stop the run */
+static struct replayrec *currec;  /* record of the packet in tolayer3() */
+static char *telefile;            /* time series of the queue and windows, see -S */
+static FILE *telemetry;
+static long televery;             /* a sample every so many events ... */
+static float teltime;             /* ... or every so many time units */
+static float nextsample;          /* simulated time of the next sample */
+static PERTHREAD long nevents_done; /* events taken off the queue so far */
+static long nsamples;             /* rows written to telefile */
+static PERTHREAD int evmix[4];    /* events of each type since the last sample */
+static PERTHREAD int inflight[2]; /* packets on their way from A and from B */
+static unsigned long nrandom;     /* jimsrand() calls since srand() */
+static int splitrng;              /* A and B draw from streams of their own, see -i */
+static unsigned long streams[2];  /* their state */
+static int nthreads = 1;          /* 2: A and B run on threads of their own, see -t */
+static PERTHREAD int curside;     /* the side whose event is being handled */
+static char *ckptfile;            /* checkpoint written here, see -C */
+static float ckpttime;            /* simulated time of the next checkpoint */
+static float ckptevery;           /* and of the ones after it, 0 for just one */
+static char *resumefile;          /* checkpoint to start from, see -L */
+static int stopmetric;            /* metric whose confidence interval ends the run, see -E */
+static double stoptarget;         /* relative half-width that is good enough */
+static int batchsize = 50;        /* messages delivered per batch */
+static int batchmsgs;             /* delivered in the current batch so far */
+static double batchsum;           /* their bytes, or their summed latency */
+static float batchstart;          /* when the current batch began */
+static int nbatches;              /* batches completed */
+static double bmsum, bmsumsq;     /* sum and sum of squares of the batch means */
+static int converged;             /* the target was reached, stop the run */
+static long eventcap;             /* stop after this many events, see -X */
+static char *srcfile;             /* layer 5 sends the contents of this, see -I */
+static char *srcdata;             /* the mapped file */
+static unsigned long srcsize;     /* its length */
+static char *sinkfile;            /* B's delivered data is written here, see -O */
+static int sinkfd = -1;
+static char *sinkbuf;             /* delivered data not written yet */
+static size_t sinkused;           /* how much of sinkbuf that is */
+static unsigned long sinkbytes;   /* bytes written to sinkfile */
+static unsigned long sinkwrites;  /* writev() calls it took */
+static struct generator *gen;     /* how messages arrive from layer 5, see -A */
+static float ontime, offtime;     /* -A onoff: mean on and off periods ... */
+static float onshape = 1.5;       /* ... and the shape of their Pareto distribution */
+static char *arrfile;             /* -A trace: arrival timestamps, one per line */
+static float *arrtimes;
+static long narrtimes;
+static float warmup;              /* statistics leave out the events before this, see -U */
+static float statstart;           /* when the statistics began: 0, or warmup once reached */
+static int warmedup;              /* warmup has been reached */
+static float horizon;             /* stop at this simulated time, see -H */
+static char *livefile;            /* statistics shared while the run goes on, see -M */
+static struct livestats *live;    /* the mapped file */
+static float readrate;            /* bytes per time unit B's application reads, see -D */
+static double maxunread;          /* most bytes B's application had waiting at once */
+static struct router routers[MAXHOPS]; /* the path from A to B, see -P */
+static int nhops;
+static struct hopqueue hopq[MAXHOPS][2]; /* queues of packets from A and from B */
+
+/* Everything a checkpoint holds besides the flows, the pending events and */
+/* the protocol's own state.  The run's parameters are not in it: they are */
+/* given again when resuming, and may differ to branch off a what-if run.  */
+/* rand() cannot be saved, so its state is the number of calls made.  The  */
+/* list is made when first needed, since the address of a PERTHREAD        */
+/* variable is not a constant.                                             */
+#define MAXSNAP 64
+#define SNAP(x) (snapvars[nsnapvars].addr = &(x), snapvars[nsnapvars++].size = sizeof(x))
+static struct {
+  void *addr;
+  size_t size;
+} snapvars[MAXSNAP];
+static int nsnapvars;
+
+void listsnapvars(void)
+{
+  if (nsnapvars > 0)
+    return;
+  SNAP(simtime), SNAP(nsim), SNAP(nextseq), SNAP(nrandom), SNAP(streams);
+  SNAP(window_full), SNAP(rcv_buffer_max), SNAP(total_ACKs_received);
+  SNAP(packets_resent), SNAP(new_ACKs), SNAP(packets_received);
+  SNAP(fec_recovered), SNAP(retx_recovered), SNAP(mode_switches);
+  SNAP(unacked_packets), SNAP(buffered_packets);
+  SNAP(naks_sent), SNAP(nak_resends), SNAP(timeout_resends);
+  SNAP(flow_limited), SNAP(window_probes), SNAP(maxunread);
+  SNAP(statstart), SNAP(warmedup);
+  SNAP(packets_lost), SNAP(packets_corrupt), SNAP(packets_sent);
+  SNAP(packets_timeout), SNAP(messages_delivered), SNAP(bytes_delivered);
+  SNAP(packets_reordered), SNAP(packets_expired), SNAP(parity_sent), SNAP(bytes_sentA);
+  SNAP(parity_bytes), SNAP(ntolayer3), SNAP(nlost), SNAP(ncorrupt);
+  SNAP(lastarrival), SNAP(gestate), SNAP(ge_badpkts), SNAP(lossrun);
+  SNAP(nbursts), SNAP(burstmax), SNAP(bursthist);
+  SNAP(replaynext), SNAP(replayused), SNAP(replayended);
+  SNAP(nevents_done), SNAP(inflight), SNAP(hopq);
+  SNAP(batchmsgs), SNAP(batchsum), SNAP(batchstart), SNAP(nbatches);
+  SNAP(bmsum), SNAP(bmsumsq);
+}
+
+#define CKPT_MAGIC "EMUCKPT1"
+
+/* With -i every number A's events use comes from A's stream and every one */
+/* B's use from B's, so each side sees the same numbers however the two    */
+/* are interleaved.  xorshift32, uniform in [0,1).                         */
+double sidedraw(int side)
+{
+  unsigned long x = streams[side];
+
+  x ^= (x << 13) & 0xffffffffUL;
+  x ^= x >> 17;
+  x ^= (x << 5) & 0xffffffffUL;
+  streams[side] = x;
+  return x / 4294967296.0;
+}
 
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
@@ -94,92 +384,1183 @@ double jimsrand(void)
 {
   double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
   double x;                   
-  x = rand()/mmm;            /* x should be uniform in [0,1] */
+  if (splitrng)
+    x = sidedraw(curside);
+  else {
+    nrandom++;
+    x = rand()/mmm;          /* x should be uniform in [0,1] */
+  }
   if (TRACE > 3)
     printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
   return(x);
 }  
 
-/********************* EVENT HANDLINE ROUTINES *******/
-/*  The next set of routines handle the event list   */
-/*****************************************************/
+/********************* EVENT HANDLINE ROUTINES *******/
+/*  The next set of routines handle the event list   */
+/*****************************************************/
+
+void heapplace(struct event *p, int pos)
+{
+  evheap[pos] = p;
+  p->heappos = pos;
+}
+
+/* move the event at pos towards the root until its parent comes first */
+void siftup(int pos)
+{
+  struct event *p = evheap[pos];
+
+  while (pos > 0 && EVBEFORE(p, evheap[(pos - 1) / 2])) {
+    heapplace(evheap[(pos - 1) / 2], pos);
+    pos = (pos - 1) / 2;
+  }
+  heapplace(p, pos);
+}
+
+/* move the event at pos towards the leaves until both children come later */
+void siftdown(int pos)
+{
+  struct event *p = evheap[pos];
+  int child;
+
+  while ((child = 2 * pos + 1) < nevents) {
+    if (child + 1 < nevents && EVBEFORE(evheap[child + 1], evheap[child]))
+      child++;
+    if (!EVBEFORE(evheap[child], p))
+      break;
+    heapplace(evheap[child], pos);
+    pos = child;
+  }
+  heapplace(p, pos);
+}
+
+/* put an event, whose seq is already set, into the heap */
+void heapinsert(struct event *p)
+{
+  if (nevents == maxevents) {
+    maxevents = maxevents ? 2 * maxevents : 64;
+    evheap = realloc(evheap, maxevents * sizeof(struct event *));
+    if (evheap == NULL) {
+      printf("memory allocation for event list failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  heapplace(p, nevents++);
+  siftup(p->heappos);
+}
+
+#ifdef PARALLEL
+/* What the two threads of a -t 2 run leave each other between windows */
+struct side {
+  struct event **outbox;        /* packets sent to the other side this window */
+  int nout, maxout;
+  float next;                   /* time of its earliest pending event, negative for none */
+  float clock;                  /* when the run ends: its simtime ... */
+  long events;                  /* ... and its PERTHREAD counters */
+  int ntolayer3, nlost, ncorrupt, ge_badpkts, nbursts, burstmax;
+  int bursthist[BURSTHIST];
+  int packets_reordered, packets_expired, inflight[2];
+  char pad[64];                 /* keep the two sides off each other's cache lines */
+};
+
+static struct side sides[2];
+static pthread_barrier_t barrier;
+static long nwindows;            /* windows run */
+
+/* hold a packet for the other side until the window ends */
+void post(struct event *p)
+{
+  struct side *s = &sides[curside];
+
+  if (s->nout == s->maxout) {
+    s->maxout = s->maxout ? 2 * s->maxout : 64;
+    s->outbox = realloc(s->outbox, s->maxout * sizeof(struct event *));
+    if (s->outbox == NULL) {
+      printf("memory allocation for event list failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  s->outbox[s->nout++] = p;
+}
+#endif
+
+void insertevent(struct event *p)
+{
+  PROF_DECL(t);
+
+  PROF_START(t);
+  if (TRACE>2) {
+    printf("            INSERTEVENT: time is %f\n",simtime);
+    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+  }
+  p->src = splitrng ? curside : A;
+  p->seq = nextseq[p->src]++;
+#ifdef PARALLEL
+  if (nthreads > 1 && p->eventity != curside) {
+    post(p);                /* the other side's thread takes it after this window */
+    PROF_STOP(PROF_INSERTEVENT, t);
+    return;
+  }
+#endif
+  heapinsert(p);
+  PROF_STOP(PROF_INSERTEVENT, t);
+}
+
+/* take an event out of the list, wherever it is */
+void removeevent(struct event *p)
+{
+  int pos = p->heappos;
+  PROF_DECL(t);
+
+  PROF_START(t);
+  nevents--;
+  if (pos != nevents) {
+    heapplace(evheap[nevents], pos);
+    siftup(pos);
+    siftdown(evheap[pos]->heappos);
+  }
+  PROF_STOP(PROF_REMOVEEVENT, t);
+}
+
+/* where the running named timer id of AorB is kept: the events are in */
+/* the heap with the others, so starting and stopping one is O(log n)   */
+struct event **timerslot(int AorB, int conn, int id)
+{
+  struct flow *f = &flows[conn];
+
+  if (id < 0 || id >= MAXTIMERS) {
+    printf("timer id %d is out of range, it must be 0 to %d\n", id, MAXTIMERS - 1);
+    exit(EXIT_FAILURE);
+  }
+  if (f->timers[AorB] == NULL) {
+    f->timers[AorB] = calloc(MAXTIMERS, sizeof(struct event *));
+    if (f->timers[AorB] == NULL) {
+      printf("memory allocation for timers failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return &f->timers[AorB][id];
+}
+
+/* take the next event to simulate out of the list, NULL if there is none */
+struct event *nextevent(void)
+{
+  struct event *p;
+
+  if (nevents == 0)
+    return NULL;
+  p = evheap[0];
+  removeevent(p);
+  return p;
+}
+
+/* Events and packet copies come and go at one or more per event, so */
+/* spent ones are kept here for reuse instead of going back to free(). */
+/* A packet copy is only the size of its payload, so they are kept by  */
+/* payload length, chained through their first bytes.  Under -t 2     */
+/* each thread keeps its own lists.                                    */
+static PERTHREAD struct event **spareevents = NULL;
+static PERTHREAD int nspare = 0, maxspare = 0;
+struct sparepkt {
+  struct sparepkt *next;
+};
+static PERTHREAD struct sparepkt *sparepkts[MAXPAYLOAD + 1];
+
+struct event *newevent(void)
+{
+  struct event *p;
+
+  if (nspare > 0)
+    return spareevents[--nspare];
+  p = malloc(sizeof(struct event));
+  if (p == NULL) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+void freeevent(struct event *p)
+{
+  struct event **more;
+
+  if (nspare == maxspare) {
+    more = realloc(spareevents, (maxspare ? 2 * maxspare : 64) * sizeof(struct event *));
+    if (more == NULL) {
+      free(p);
+      return;
+    }
+    spareevents = more;
+    maxspare = maxspare ? 2 * maxspare : 64;
+  }
+  spareevents[nspare++] = p;
+}
+
+/* room for a copy of a packet with length bytes of payload */
+struct pkt *newpkt(int length)
+{
+  struct sparepkt *s = sparepkts[length];
+  struct pkt *p;
+
+  if (s != NULL) {
+    sparepkts[length] = s->next;
+    return (struct pkt *)s;
+  }
+  p = malloc(PKT_HDRLEN + (size_t)length);
+  if (p == NULL) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+void freepkt(struct pkt *p)
+{
+  int length = p->length;
+  struct sparepkt *s = (struct sparepkt *)p;
+
+  s->next = sparepkts[length];
+  sparepkts[length] = s;
+}
+
+/* the original generator: uniform on [0,2*lambda], having mean of lambda */
+double gen_uniform(int conn)
+{
+  return lambda*jimsrand()*2;
+}
+
+/* Poisson arrivals with mean spacing lambda */
+double gen_exponential(int conn)
+{
+  return -lambda * log(1.0 - jimsrand() * 0.999999);
+}
+
+/* an always backlogged sender: the next message is there at once, and */
+/* one A refuses is offered again after A's next event (see main())     */
+double gen_saturate(int conn)
+{
+  return 0.0;
+}
+
+/* a Pareto distributed period with the given mean, onshape > 1 */
+double pareto(double mean)
+{
+  return mean * (onshape - 1) / onshape / pow(1.0 - jimsrand() * 0.999999, 1.0 / onshape);
+}
+
+/* bursts: a message every lambda during on periods, none during off */
+/* periods, both of Pareto distributed length                        */
+double gen_onoff(int conn)
+{
+  struct flow *f = &flows[conn];
+  double when = simtime + lambda;
+
+  if (when > f->onuntil) {
+    when = f->onuntil + pareto(offtime);
+    f->onuntil = when + pareto(ontime);
+  }
+  return when - simtime;
+}
+
+/* the timestamps in arrfile, the same ones for every connection */
+double gen_trace(int conn)
+{
+  struct flow *f = &flows[conn];
+
+  if (f->arrnext >= narrtimes)
+    return -1.0;
+  f->arrnext++;
+  return arrtimes[f->arrnext - 1] > simtime ? arrtimes[f->arrnext - 1] - simtime : 0.0;
+}
+
+static struct generator generators[] = {
+  { "uniform", gen_uniform },         /* first: the default */
+  { "exponential", gen_exponential },
+  { "saturate", gen_saturate },
+  { "onoff", gen_onoff },
+  { "trace", gen_trace },
+  { NULL, NULL }
+};
+
+/* read the -A trace file, timestamps in ascending order */
+void openarrivals(void)
+{
+  FILE *f;
+  float t;
+  long room = 0;
+
+  f = fopen(arrfile, "r");
+  if (f == NULL) {
+    printf("cannot open %s\n", arrfile);
+    exit(EXIT_FAILURE);
+  }
+  while (fscanf(f, "%f", &t) == 1) {
+    if (narrtimes == room) {
+      room = room ? 2 * room : 1024;
+      arrtimes = realloc(arrtimes, room * sizeof(float));
+      if (arrtimes == NULL) {
+        printf("memory allocation for %s failed.", arrfile);
+        exit(EXIT_FAILURE);
+      }
+    }
+    arrtimes[narrtimes++] = t;
+  }
+  fclose(f);
+  if (narrtimes == 0) {
+    printf("no timestamps in %s\n", arrfile);
+    exit(EXIT_FAILURE);
+  }
+}
+
+void generate_next_arrival(int conn)
+{
+  double x;
+  struct event *evptr;
+
+  if (TRACE>2)
+    printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
+ 
+  x = gen->next(conn);
+  if (x < 0.0)
+    return;
+  evptr = newevent();
+  evptr->evtime =  simtime + x;
+  evptr->evtype =  FROM_LAYER5;
+  evptr->conn = conn;
+  if (BIDIRECTIONAL && (jimsrand()>0.5) )
+    evptr->eventity = B;
+  else
+    evptr->eventity = A;
+  insertevent(evptr);
+} 
+
+#ifdef PROFILE
+/* hot path instrumentation, see prof.h */
+struct profstat profstats[PROF_NFUNCS];
+
+static char *profnames[PROF_NFUNCS] = {
+  "nextevent", "insertevent", "removeevent", "starttimer", "stoptimer",
+  "tolayer3", "tolayer5", "ComputeChecksum", "A_output", "A_input",
+  "B_input", "A_timerinterrupt"
+};
+
+void profrecord(int func, unsigned long ticks)
+{
+  struct profstat *ps = &profstats[func];
+  int b = 0;
+
+  ps->calls++;
+  ps->total += ticks;
+  if (ticks > ps->max)
+    ps->max = ticks;
+  while (ticks > 0 && b < PROF_BUCKETS - 1) {
+    ticks >>= 1;
+    b++;
+  }
+  ps->hist[b]++;
+}
+
+unsigned long profclock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* upper bound of the bucket holding the fraction p of the calls */
+static unsigned long profpercentile(struct profstat *ps, double p)
+{
+  unsigned long seen = 0;
+  int b;
+
+  for (b = 0; b < PROF_BUCKETS - 1; b++) {
+    seen += ps->hist[b];
+    if (seen >= p * ps->calls)
+      break;
+  }
+  return b == 0 ? 0 : 1UL << b;
+}
+
+void profdump(void)
+{
+  struct profstat *ps;
+  unsigned long t0, t1, overhead = (unsigned long)-1;
+  int i;
+
+  /* what taking the time twice costs, which every figure below includes */
+  for (i = 0; i < 1000; i++) {
+    PROF_NOW(t0);
+    PROF_NOW(t1);
+    if (t1 - t0 < overhead)
+      overhead = t1 - t0;
+  }
+  printf("\nhot path profile (%s, inclusive, about %lu of each call is timer overhead)\n",
+         PROF_UNIT, overhead);
+  printf("%-17s %10s %14s %9s %8s %8s %10s\n",
+         "function", "calls", "total", "mean", "p50<=", "p99<=", "max");
+  for (i = 0; i < PROF_NFUNCS; i++) {
+    ps = &profstats[i];
+    if (ps->calls == 0)
+      continue;
+    printf("%-17s %10lu %14lu %9.1f %8lu %8lu %10lu\n", profnames[i], ps->calls,
+           ps->total, (double)ps->total / ps->calls, profpercentile(ps, 0.5),
+           profpercentile(ps, 0.99), ps->max);
+  }
+}
+#endif
+
+/* Save the whole state of the run.  It goes to a temporary file first and */
+/* is renamed over the old checkpoint, so a crash never leaves a torn one. */
+void savecheckpoint(void)
+{
+  char tmpname[FILENAME_MAX];
+  FILE *f;
+  struct event *p;
+  int i;
+
+  sprintf(tmpname, "%.*s.tmp", FILENAME_MAX - 5, ckptfile);
+  if ((f = fopen(tmpname, "wb")) == NULL) {
+    printf("cannot write checkpoint %s\n", tmpname);
+    exit(EXIT_FAILURE);
+  }
+  fwrite(CKPT_MAGIC, 1, strlen(CKPT_MAGIC), f);
+  fwrite(&nflows, sizeof(nflows), 1, f);
+  listsnapvars();
+  for (i = 0; i < nsnapvars; i++)
+    fwrite(snapvars[i].addr, snapvars[i].size, 1, f);
+  fwrite(flows, sizeof(struct flow), nflows, f);
+  fwrite(&nevents, sizeof(nevents), 1, f);
+  for (i = 0; i < nevents; i++) {
+    p = evheap[i];
+    fwrite(p, sizeof(struct event), 1, f);
+    if (p->evtype == FROM_LAYER3 || p->evtype == FROM_ROUTER)
+      fwrite(p->pktptr, PKT_USED(*p->pktptr), 1, f);
+  }
+  save_state(f);
+  if (fclose(f) != 0 || rename(tmpname, ckptfile) != 0) {
+    printf("cannot write checkpoint %s\n", ckptfile);
+    exit(EXIT_FAILURE);
+  }
+  printf("checkpoint saved to %s at time %f\n", ckptfile, simtime);
+}
+
+void badcheckpoint(char *why)
+{
+  printf("cannot resume from %s: %s\n", resumefile, why);
+  exit(EXIT_FAILURE);
+}
+
+/* Replace the state set up by init(), A_init() and B_init() with the one */
+/* in resumefile.  Events keep their seq, so they come out in the same    */
+/* order, and rand() is brought to the same point by replaying its calls. */
+void loadcheckpoint(void)
+{
+  FILE *f;
+  char magic[sizeof(CKPT_MAGIC)];
+  struct event *p;
+  struct pkt hdr;
+  unsigned long n;
+  int i, count, conns;
+
+  if ((f = fopen(resumefile, "rb")) == NULL)
+    badcheckpoint("cannot open it");
+  if (fread(magic, 1, strlen(CKPT_MAGIC), f) != strlen(CKPT_MAGIC)
+      || memcmp(magic, CKPT_MAGIC, strlen(CKPT_MAGIC)) != 0)
+    badcheckpoint("not a checkpoint");
+  if (fread(&conns, sizeof(conns), 1, f) != 1 || conns != nflows)
+    badcheckpoint("it was saved with a different number of connections (-n)");
+  listsnapvars();
+  for (i = 0; i < nsnapvars; i++)
+    if (fread(snapvars[i].addr, snapvars[i].size, 1, f) != 1)
+      badcheckpoint("truncated");
+  for (i = 0; i < nflows; i++) {
+    free(flows[i].timers[A]);
+    free(flows[i].timers[B]);
+  }
+  if (fread(flows, sizeof(struct flow), nflows, f) != (size_t)nflows)
+    badcheckpoint("truncated");
+
+  /* drop the first arrivals init() scheduled */
+  while ((p = nextevent()) != NULL)
+    freeevent(p);
+  for (i = 0; i < nflows; i++) {
+    flows[i].timer[A] = flows[i].timer[B] = NULL;
+    flows[i].timers[A] = flows[i].timers[B] = NULL;
+  }
+
+  if (fread(&count, sizeof(count), 1, f) != 1)
+    badcheckpoint("truncated");
+  for (i = 0; i < count; i++) {
+    p = malloc(sizeof(struct event));
+    if (p == NULL || fread(p, sizeof(struct event), 1, f) != 1)
+      badcheckpoint("truncated");
+    if (p->evtype == FROM_LAYER3 || p->evtype == FROM_ROUTER) {
+      if (fread(&hdr, PKT_HDRLEN, 1, f) != 1 || hdr.length < 0 || hdr.length > MAXPAYLOAD)
+        badcheckpoint("bad packet");
+      p->pktptr = malloc(PKT_USED(hdr));
+      if (p->pktptr == NULL)
+        badcheckpoint("out of memory");
+      memcpy(p->pktptr, &hdr, PKT_HDRLEN);
+      if (hdr.length > 0 && fread(p->pktptr->payload, hdr.length, 1, f) != 1)
+        badcheckpoint("truncated");
+    }
+    else
+      p->pktptr = NULL;
+    if (p->evtype == TIMER_INTERRUPT && p->timerid == NOTIMER)
+      flows[p->conn].timer[p->eventity] = p;
+    else if (p->evtype == TIMER_INTERRUPT)
+      *timerslot(p->eventity, p->conn, p->timerid) = p;
+    heapinsert(p);
+  }
+  if (restore_state(f) != 0)
+    badcheckpoint("truncated protocol state");
+  fclose(f);
+
+  srand(9999);
+  for (n = 0; n < nrandom; n++)
+    rand();
+  if (teltime > 0.0)
+    nextsample = teltime * ((long)(simtime / teltime) + 1);
+  while (ckptfile && ckpttime <= simtime && ckptevery > 0.0)
+    ckpttime += ckptevery;
+  printf("resumed from %s at time %f\n", resumefile, simtime);
+}
+
+/* one row of the -S time series.  The event counts are those handled */
+/* since the previous row.                                            */
+void sample(float when)
+{
+  fprintf(telemetry, "%f,%ld,%d,%d,%d,%d,%d,%d,%d,%d\n", when, nevents_done, nevents,
+          evmix[TIMER_INTERRUPT], evmix[FROM_LAYER5], evmix[FROM_LAYER3],
+          inflight[A], inflight[B], unacked_packets, buffered_packets);
+  evmix[TIMER_INTERRUPT] = evmix[FROM_LAYER5] = evmix[FROM_LAYER3] = 0;
+  nsamples++;
+}
+
+/* the PERTHREAD part of resetstats(), which under -t 2 B's thread */
+/* does for itself                                                 */
+void resetcounts(void)
+{
+  int i;
+
+  packets_reordered = packets_expired = ntolayer3 = nlost = ncorrupt = ge_badpkts = 0;
+  nbursts = burstmax = 0;
+  for (i = 0; i < BURSTHIST; i++)
+    bursthist[i] = 0;
+}
+
+/* The warm-up is over: start every statistic again from zero.  Gauges */
+/* (packets held right now) and the -I check are left alone.            */
+void resetstats(void)
+{
+  struct hopqueue *q;
+  int i, j;
+
+  window_full = rcv_buffer_max = total_ACKs_received = packets_resent = 0;
+  new_ACKs = packets_received = fec_recovered = retx_recovered = mode_switches = 0;
+  naks_sent = nak_resends = timeout_resends = flow_limited = window_probes = 0;
+  messages_delivered = parity_sent = 0;
+  bytes_delivered = bytes_sentA = parity_bytes = 0;
+  resetcounts();
+  maxunread = 0.0;
+  for (i = 0; i < nhops; i++)
+    for (j = 0; j < 2; j++) {
+      q = &hopq[i][j];
+      q->arrived = q->resent = q->lost = q->overflowed = q->forwarded = 0;
+      q->maxqueue = q->count;
+      q->queuesum = 0.0;
+    }
+  for (i = 0; i < nflows; i++) {
+    flows[i].generated = flows[i].delivered = flows[i].datasent = 0;
+    flows[i].bytes = 0;
+  }
+  batchmsgs = nbatches = 0;
+  batchsum = bmsum = bmsumsq = 0.0;
+  batchstart = warmup;
+  statstart = warmup;
+  warmedup = 1;
+}
+
+/* Copy the counters into the -M file: plain stores between two updates */
+/* of seq, and no lock, so the emulator never waits for a reader.         */
+void publish(int running)
+{
+  unsigned long seq = live->seq;
+
+  __atomic_store_n(&live->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  live->running = running;
+  live->simtime = simtime;
+  live->events = nevents_done;
+  live->queue = nevents;
+  live->nsim = nsim;
+  live->messages_delivered = messages_delivered;
+  live->bytes_delivered = bytes_delivered;
+  live->packets_resent = packets_resent;
+  live->new_ACKs = new_ACKs;
+  live->packets_received = packets_received;
+  live->window_full = window_full;
+  live->packets_lost = nlost;
+  live->packets_corrupted = ncorrupt;
+  live->unacked_packets = unacked_packets;
+  live->buffered_packets = buffered_packets;
+  __atomic_store_n(&live->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* seconds since 1970, for the -M file */
+double wallclock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* map the -M file, shared so that livestats sees every update */
+void openlive(void)
+{
+  int fd;
+
+  fd = open(livefile, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0 || ftruncate(fd, sizeof(struct livestats)) < 0) {
+    printf("cannot write %s\n", livefile);
+    exit(EXIT_FAILURE);
+  }
+  live = mmap(NULL, sizeof(struct livestats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (live == MAP_FAILED) {
+    printf("cannot map %s\n", livefile);
+    exit(EXIT_FAILURE);
+  }
+  memcpy(live->magic, LIVE_MAGIC, sizeof(live->magic));
+  live->started = wallclock();
+  publish(1);
+}
+
+/* events are printed in heap order, not time order */
+void printevlist(void)
+{
+  int i;
+  struct event *q;
+  printf("--------------\nEvent List Follows:\n");
+  for (i = 0; i < nevents; i++) {
+    q = evheap[i];
+    printf("Event time: %f, type: %d entity: %d conn: %d\n",q->evtime,q->evtype,q->eventity,q->conn);
+  }
+  printf("--------------\n");
+}
+
+void usage(char *prog)
+{
+  printf("usage: %s [-m mtu] [-s msgsize] [-r prob] [-j mean] [-J dist]\n"
+         "       [-G pgb,pbg,lossbad[,corruptbad]] [-T file[,loop]] [-n flows] [-F k]\n"
+         "       [-R sr|gbn|adaptive] [-S file[,every]] [-C file,T[,every]]\n"
+         "       [-L file] [-E goodput|latency,width[,batch]] [-X events] [-W window]\n"
+         "       [-I file] [-O file] [-K holdoff] [-D rate] [-A generator]\n"
+         "       [-U warmup] [-H horizon] [-M file] [-P path] [-i] [-t threads]\n", prog);
+  printf("  -m mtu      payload bytes carried per packet (1..%d, default %d)\n",
+         MAXPAYLOAD, MAXPAYLOAD);
+  printf("  -s msgsize  bytes per message from layer 5 (1..%d, default 20)\n",
+         MAXMSG);
+  printf("  -r prob     probability a packet ignores FIFO order (default 0);\n"
+         "              packets that would take over %d to arrive are then lost\n",
+         MAXLIFETIME);
+  printf("  -j mean     mean jitter of such packets (default 5.0)\n");
+  printf("  -J dist     jitter distribution: uniform, exponential, normal\n");
+  printf("  -G ...      Gilbert-Elliott channel: P(good->bad), P(bad->good) per\n"
+         "              packet and the loss (and corruption) probability in the\n"
+         "              bad state; the good state uses the prompted ones\n");
+  printf("  -T file     replay loss, corruption and delay decisions from file,\n"
+         "              stopping at its end, or starting over with ,loop\n");
+  printf("  -n flows    number of A->B connections sharing the channel (default 1)\n");
+  printf("  -F k        sr.c sends one XOR parity packet per k data packets\n");
+  printf("  -R mode     sr.c resends after a timeout: sr (the timed out packet,\n"
+         "              default), gbn (every unacked packet) or adaptive\n");
+  printf("  -S file     write a time series of the event queue, packets in\n"
+         "              flight, windows and receive buffers to file, every 1000\n"
+         "              events or ,N events or ,Tt simulated time units\n");
+  printf("  -C file,T   save the whole simulation to file at time T, and every\n"
+         "              T time units after that with ,every\n");
+  printf("  -L file     resume from a file saved with -C; give the same answers\n"
+         "              and switches to continue the run exactly\n");
+  printf("  -E m,width  stop once the 95%% confidence interval of goodput or\n"
+         "              latency, from batches of 50 (or ,batch) delivered\n"
+         "              messages, is within +-width of its mean (e.g. 0.02)\n");
+  printf("  -X events   stop after this many events in any case\n");
+  printf("  -W window   packets in A's window; the protocol must be built for it\n"
+         "              unless it was built with -DRUNTIME_WINDOW (see engines.c)\n");
+  printf("  -I file     every connection sends the contents of file (over and\n"
+         "              over) and what B delivers is checked against it\n");
+  printf("  -O file     write the data B delivers to file, buffered\n");
+  printf("  -K holdoff  sr.c's B lists the packets missing below an out of order\n"
+         "              one in its ACK (a NAK) and A resends them at once; a\n"
+         "              packet is named again after holdoff more arrivals\n");
+  printf("  -D rate     B's application reads only rate bytes per time unit, and\n"
+         "              sr.c's B advertises the room left in its window\n");
+  printf("  -A gen      how messages arrive: uniform (on [0,2*lambda], default),\n"
+         "              exponential (mean lambda), saturate (whenever A has room),\n"
+         "              onoff,on,off[,shape] (every lambda during Pareto on\n"
+         "              periods of mean on, none for off, shape 1.5) or\n"
+         "              trace,file (at the times listed in file)\n");
+  printf("  -U warmup   leave everything before this simulated time out of the\n"
+         "              statistics\n");
+  printf("  -H horizon  stop at this simulated time, even with messages left\n");
+  printf("  -M file     keep the statistics in file, updated after the events of\n"
+         "              each time step, for livestats to show while the run goes on\n");
+  printf("  -P path     routers between A and B, each given as\n"
+         "              delay,loss,queue[,service] and separated by colons: the\n"
+         "              delay to the next node, the loss probability, the packets\n"
+         "              it can queue (1..%d) and the time to send one (default 1)\n",
+         MAXQUEUE);
+  printf("  -i          A and B draw random numbers from streams of their own, and\n"
+         "              events due at once are ordered per side\n");
+  printf("  -t 1|2      run sequentially (default) or, in a build with -DPARALLEL,\n"
+         "              with A and B on two threads; 2 implies -i and TRACE 0\n");
+  exit(EXIT_FAILURE);
+}
+
+/* the optional command line switches; everything else is prompted for */
+void parseargs(int argc, char **argv)
+{
+  struct router *r;
+  int i;
+  char *p;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-m") == 0 && i+1 < argc)
+      mtu = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0 && i+1 < argc)
+      msgsize = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-r") == 0 && i+1 < argc)
+      reorderprob = atof(argv[++i]);
+    else if (strcmp(argv[i], "-j") == 0 && i+1 < argc)
+      jitter = atof(argv[++i]);
+    else if (strcmp(argv[i], "-J") == 0 && i+1 < argc) {
+      i++;
+      if (strcmp(argv[i], "uniform") == 0)
+        jitterdist = JITTER_UNIFORM;
+      else if (strcmp(argv[i], "exponential") == 0)
+        jitterdist = JITTER_EXPONENTIAL;
+      else if (strcmp(argv[i], "normal") == 0)
+        jitterdist = JITTER_NORMAL;
+      else
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-G") == 0 && i+1 < argc) {
+      gilbert = 1;
+      ge_corruptbad = -1.0;
+      if (sscanf(argv[++i], "%f,%f,%f,%f", &ge_pgb, &ge_pbg, &ge_lossbad,
+                 &ge_corruptbad) < 3)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-T") == 0 && i+1 < argc) {
+      replayfile = argv[++i];
+      if (strlen(replayfile) > 5 && strcmp(replayfile + strlen(replayfile) - 5, ",loop") == 0) {
+        replayfile[strlen(replayfile) - 5] = '\0';
+        replayloop = 1;
+      }
+    }
+    else if (strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      nflows = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-F") == 0 && i+1 < argc)
+      fec_k = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-S") == 0 && i+1 < argc) {
+      telefile = argv[++i];
+      televery = 1000;
+      if ((p = strrchr(telefile, ',')) != NULL) {
+        *p++ = '\0';
+        if (*p != '\0' && p[strlen(p) - 1] == 't') {
+          teltime = atof(p);
+          televery = 0;
+        }
+        else
+          televery = atol(p);
+        if (televery <= 0 && teltime <= 0.0)
+          usage(argv[0]);
+      }
+    }
+    else if (strcmp(argv[i], "-C") == 0 && i+1 < argc) {
+      ckptfile = argv[++i];
+      if ((p = strchr(ckptfile, ',')) == NULL)
+        usage(argv[0]);
+      *p++ = '\0';
+      ckpttime = atof(p);
+      if ((p = strchr(p, ',')) != NULL) {
+        if (strcmp(p, ",every") != 0)
+          usage(argv[0]);
+        ckptevery = ckpttime;
+      }
+      if (ckpttime <= 0.0)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-L") == 0 && i+1 < argc)
+      resumefile = argv[++i];
+    else if (strcmp(argv[i], "-E") == 0 && i+1 < argc) {
+      i++;
+      if (strncmp(argv[i], "goodput,", 8) == 0)
+        stopmetric = STOP_GOODPUT;
+      else if (strncmp(argv[i], "latency,", 8) == 0)
+        stopmetric = STOP_LATENCY;
+      else
+        usage(argv[0]);
+      if (sscanf(argv[i] + 8, "%lf,%d", &stoptarget, &batchsize) < 1
+          || stoptarget <= 0.0 || batchsize < 1)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-I") == 0 && i+1 < argc)
+      srcfile = argv[++i];
+    else if (strcmp(argv[i], "-O") == 0 && i+1 < argc)
+      sinkfile = argv[++i];
+    else if (strcmp(argv[i], "-A") == 0 && i+1 < argc) {
+      i++;
+      for (gen = generators; gen->name != NULL; gen++)
+        if (strncmp(argv[i], gen->name, strlen(gen->name)) == 0)
+          break;
+      if (gen->name == NULL)
+        usage(argv[0]);
+      p = argv[i] + strlen(gen->name);
+      if (gen->next == gen_onoff) {
+        if (sscanf(p, ",%f,%f,%f", &ontime, &offtime, &onshape) < 2
+            || ontime <= 0.0 || offtime < 0.0 || onshape <= 1.0)
+          usage(argv[0]);
+      }
+      else if (gen->next == gen_trace) {
+        if (*p++ != ',' || *p == '\0')
+          usage(argv[0]);
+        arrfile = p;
+      }
+      else if (*p != '\0')
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-U") == 0 && i+1 < argc) {
+      warmup = atof(argv[++i]);
+      if (warmup <= 0.0)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-M") == 0 && i+1 < argc)
+      livefile = argv[++i];
+    else if (strcmp(argv[i], "-P") == 0 && i+1 < argc) {
+      for (p = strtok(argv[++i], ":"); p != NULL; p = strtok(NULL, ":")) {
+        if (nhops == MAXHOPS) {
+          printf("there can be at most %d routers\n", MAXHOPS);
+          exit(EXIT_FAILURE);
+        }
+        r = &routers[nhops++];
+        r->service = 1.0;
+        if (sscanf(p, "%f,%f,%d,%f", &r->delay, &r->loss, &r->qlimit, &r->service) < 3)
+          usage(argv[0]);
+        if (r->delay < 0.0 || r->loss < 0.0 || r->loss > 1.0 || r->qlimit < 1
+            || r->qlimit > MAXQUEUE || r->service < 0.0) {
+          printf("router %d: delay and service must not be negative, loss must be\n"
+                 "in [0,1] and the queue between 1 and %d\n", nhops, MAXQUEUE);
+          exit(EXIT_FAILURE);
+        }
+      }
+      if (nhops == 0)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-H") == 0 && i+1 < argc) {
+      horizon = atof(argv[++i]);
+      if (horizon <= 0.0)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-D") == 0 && i+1 < argc) {
+      readrate = atof(argv[++i]);
+      if (readrate <= 0.0)
+        usage(argv[0]);
+      flow_control = 1;
+    }
+    else if (strcmp(argv[i], "-K") == 0 && i+1 < argc) {
+      nak_holdoff = atoi(argv[++i]);
+      if (nak_holdoff < 1)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-W") == 0 && i+1 < argc) {
+      window_size = atoi(argv[++i]);
+      if (window_size < 1)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-X") == 0 && i+1 < argc) {
+      eventcap = atol(argv[++i]);
+      if (eventcap <= 0)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-i") == 0)
+      splitrng = 1;
+    else if (strcmp(argv[i], "-t") == 0 && i+1 < argc) {
+      nthreads = atoi(argv[++i]);
+      if (nthreads < 1 || nthreads > 2)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-R") == 0 && i+1 < argc) {
+      i++;
+      if (strcmp(argv[i], "sr") == 0)
+        retx_mode = RETX_SR;
+      else if (strcmp(argv[i], "gbn") == 0)
+        retx_mode = RETX_GBN;
+      else if (strcmp(argv[i], "adaptive") == 0)
+        retx_mode = RETX_ADAPTIVE;
+      else
+        usage(argv[0]);
+    }
+    else
+      usage(argv[0]);
+  }
+  if (nflows < 1) {
+    printf("there must be at least one connection\n");
+    exit(EXIT_FAILURE);
+  }
+  if (fec_k < 0) {
+    printf("FEC group size must not be negative\n");
+    exit(EXIT_FAILURE);
+  }
+  if (mtu < 1 || mtu > MAXPAYLOAD) {
+    printf("mtu must be between 1 and %d\n", MAXPAYLOAD);
+    exit(EXIT_FAILURE);
+  }
+  if (msgsize < 1 || msgsize > MAXMSG) {
+    printf("message size must be between 1 and %d\n", MAXMSG);
+    exit(EXIT_FAILURE);
+  }
+  if (reorderprob < 0.0 || reorderprob > 1.0 || jitter < 0.0) {
+    printf("reorder probability must be in [0,1] and jitter not negative\n");
+    exit(EXIT_FAILURE);
+  }
+  if (reorderprob > 0.0 && nhops > 0) {
+    /* the routers' queues could keep a packet past MAXLIFETIME */
+    printf("-r cannot be used with -P\n");
+    exit(EXIT_FAILURE);
+  }
+  if (horizon > 0.0 && warmup >= horizon) {
+    printf("the warm-up must end before the horizon\n");
+    exit(EXIT_FAILURE);
+  }
+  if (gilbert && (ge_pgb < 0.0 || ge_pgb > 1.0 || ge_pbg < 0.0 || ge_pbg > 1.0
+                  || ge_lossbad < 0.0 || ge_lossbad > 1.0 || ge_corruptbad > 1.0)) {
+    printf("Gilbert-Elliott probabilities must be in [0,1]\n");
+    exit(EXIT_FAILURE);
+  }
+  if (nthreads > 1) {
+#ifndef PARALLEL
+    printf("-t 2 needs a build with -DPARALLEL -pthread\n");
+    exit(EXIT_FAILURE);
+#endif
+#ifdef PROFILE
+    printf("-t 2 cannot be used in a -DPROFILE build, whose figures are shared\n");
+    exit(EXIT_FAILURE);
+#endif
+    /* these need the events of both sides in one sequence, or (-P) give */
+    /* a packet less than a time unit on its way                         */
+    if (replayfile || ckptfile || resumefile || stopmetric || eventcap > 0
+        || telefile || livefile || nhops > 0 || BIDIRECTIONAL) {
+      printf("-t 2 cannot be used with -T, -C, -L, -E, -X, -S, -M or -P\n");
+      exit(EXIT_FAILURE);
+    }
+    splitrng = 1;
+  }
+}
+
+/* map the -I file once: messages are copied straight out of it */
+void opensource(void)
+{
+  int fd;
+  struct stat st;
+
+  fd = open(srcfile, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    printf("cannot open %s\n", srcfile);
+    exit(EXIT_FAILURE);
+  }
+  if (st.st_size == 0) {
+    printf("%s is empty\n", srcfile);
+    exit(EXIT_FAILURE);
+  }
+  srcsize = st.st_size;
+  srcdata = mmap(NULL, srcsize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (srcdata == MAP_FAILED) {
+    printf("cannot map %s\n", srcfile);
+    exit(EXIT_FAILURE);
+  }
+  posix_madvise(srcdata, srcsize, POSIX_MADV_SEQUENTIAL);
+}
+
+/* carry a 32 bit FNV-1a hash on over len bytes */
+unsigned long fnv(unsigned long hash, char *data, unsigned long len)
+{
+  while (len-- > 0) {
+    hash ^= (unsigned char)*data++;
+    hash = (hash * FNV_PRIME) & 0xffffffffUL;
+  }
+  return hash;
+}
+
+/* hash of the first len bytes the -I file gives, wrapping at its end */
+unsigned long sourcehash(unsigned long len)
+{
+  unsigned long hash = FNV_OFFSET, n;
+
+  while (len > 0) {
+    n = len < srcsize ? len : srcsize;
+    hash = fnv(hash, srcdata, n);
+    len -= n;
+  }
+  return hash;
+}
+
+/* the next message of connection conn from the -I file: up to msgsize */
+/* bytes, stopping at the end of the file                              */
+void sourcemsg(int conn, struct msg *m)
+{
+  unsigned long pos = flows[conn].srcpos;
 
-void insertevent(struct event *p)
+  m->length = srcsize - pos < (unsigned long)msgsize ? (int)(srcsize - pos) : msgsize;
+  memcpy(m->data, srcdata + pos, m->length);
+}
+
+/* Compare each connection's delivered stream with the file.  A stream   */
+/* passes when it hashes like the same number of bytes from the file; it */
+/* may be shorter than what A accepted if the run was cut short.  The    */
+/* check covers the whole run, -U warm-up included.                       */
+void printsource(double cpusecs)
 {
-  struct event *q,*qold;
+  int i, bad = 0, firstbad = -1;
+  unsigned long accepted = 0, delivered = 0, verified = 0;
 
-  if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
-    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+  for (i = 0; i < nflows; i++) {
+    accepted += flows[i].srcbytes;
+    delivered += flows[i].rcvbytes;
+    if (flows[i].rcvhash == sourcehash(flows[i].rcvbytes) && flows[i].rcvbytes <= flows[i].srcbytes)
+      verified += flows[i].rcvbytes;
+    else if (bad++ == 0)
+      firstbad = i;
   }
-  q = evlist;     /* q points to front of list in which p struct inserted */
-  if (q==NULL) {   /* list is empty */
-    evlist=p;
-    p->next=NULL;
-    p->prev=NULL;
+  printf("file source %s (%lu bytes):  %lu bytes accepted by A, %lu delivered, %lu verified \n",
+         srcfile, srcsize, accepted, delivered, verified);
+  if (bad > 0)
+    printf("MISMATCH: delivered data differs from the file on %d of %d connections (first: %d) \n",
+           bad, nflows, firstbad);
+  else
+    printf("delivered data matches the file on all %d connections \n", nflows);
+  if (simtime > 0.0)
+    printf("verified goodput (bytes per simulated time unit):  %f \n", verified / simtime);
+  if (cpusecs > 0.0)
+    printf("verified goodput (bytes per CPU second):  %.0f \n", verified / cpusecs);
+}
+
+/* the -O file, emptied first, and the buffer that gathers writes to it */
+void opensink(void)
+{
+  sinkfd = open(sinkfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  sinkbuf = malloc(SINKBUF);
+  if (sinkfd < 0 || sinkbuf == NULL) {
+    printf("cannot write %s\n", sinkfile);
+    exit(EXIT_FAILURE);
   }
-  else {
-    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
-      qold=q; 
-    if (q==NULL) {   /* end of list */
-      qold->next = p;
-      p->prev = qold;
-      p->next = NULL;
+}
+
+/* write all of iov[0..n-1], carrying on after a short write */
+void sinkwritev(struct iovec *iov, int n)
+{
+  ssize_t done;
+
+  while (n > 0) {
+    done = writev(sinkfd, iov, n);
+    if (done < 0 && errno == EINTR)
+      continue;
+    if (done < 0) {
+      printf("cannot write %s\n", sinkfile);
+      exit(EXIT_FAILURE);
     }
-    else if (q==evlist) { /* front of list */
-      p->next=evlist;
-      p->prev=NULL;
-      p->next->prev=p;
-      evlist = p;
+    sinkwrites++;
+    sinkbytes += done;
+    while (n > 0 && (size_t)done >= iov->iov_len) {
+      done -= iov->iov_len;
+      iov++;
+      n--;
     }
-    else {     /* middle of list */
-      p->next=q;
-      p->prev=q->prev;
-      q->prev->next=p;
-      q->prev=p;
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + done;
+      iov->iov_len -= done;
     }
   }
 }
 
-void generate_next_arrival(void)
+/* Append delivered data to the -O file.  It is copied into sinkbuf while */
+/* it fits; when it does not, the buffer and the new data go out together */
+/* in one writev(), so a large delivery is never copied at all.            */
+void sinkappend(char *data, int length)
 {
-  double x;
-  struct event *evptr;
+  struct iovec iov[2];
 
-  if (TRACE>2)
-    printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
- 
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+  if (sinkused + length <= SINKBUF) {
+    memcpy(sinkbuf + sinkused, data, length);
+    sinkused += length;
+    return;
   }
-  evptr->evtime =  time + x;
-  evptr->evtype =  FROM_LAYER5;
-  if (BIDIRECTIONAL && (jimsrand()>0.5) )
-    evptr->eventity = B;
-  else
-    evptr->eventity = A;
-  insertevent(evptr);
-} 
+  iov[0].iov_base = sinkbuf;
+  iov[0].iov_len = sinkused;
+  iov[1].iov_base = data;
+  iov[1].iov_len = length;
+  sinkwritev(iov, 2);
+  sinkused = 0;
+}
 
-void printevlist(void)
+/* write out what is still buffered and close the -O file */
+void closesink(void)
 {
-  struct event *q;
-  printf("--------------\nEvent List Follows:\n");
-  for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+  struct iovec iov;
+
+  iov.iov_base = sinkbuf;
+  iov.iov_len = sinkused;
+  sinkwritev(&iov, 1);
+  sinkused = 0;
+  close(sinkfd);
+  free(sinkbuf);
+}
+
+/* map the whole replay file up front, so that using a record is just a */
+/* memory read and costs no system call */
+void openreplay(void)
+{
+  int fd;
+  struct stat st;
+  char *base;
+
+  fd = open(replayfile, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    printf("cannot open replay file %s\n", replayfile);
+    exit(EXIT_FAILURE);
   }
-  printf("--------------\n");
+  nreplay = ((long)st.st_size - (long)strlen(REPLAY_MAGIC)) / (long)sizeof(struct replayrec);
+  if (nreplay <= 0) {
+    printf("replay file %s holds no records\n", replayfile);
+    exit(EXIT_FAILURE);
+  }
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    printf("cannot map replay file %s\n", replayfile);
+    exit(EXIT_FAILURE);
+  }
+  if (memcmp(base, REPLAY_MAGIC, strlen(REPLAY_MAGIC)) != 0) {
+    printf("%s is not a replay file\n", replayfile);
+    exit(EXIT_FAILURE);
+  }
+  posix_madvise(base, st.st_size, POSIX_MADV_SEQUENTIAL);
+  replay = (struct replayrec *)(base + strlen(REPLAY_MAGIC));
+  replaynext = 0;
+  replayused = 0;
+  replayended = 0;
 }
 
-void init(void)                         /* initialize the simulator */
+void init(int argc, char **argv)        /* initialize the simulator */
 {
   float sum, avg;
   int i;
 
+  parseargs(argc, argv);
   printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
   printf("Enter the number of messages to simulate: ");
   scanf("%d",&nsimmax);
@@ -187,7 +1568,9 @@ void init(void)                         /* initialize the simulator */
   scanf("%f",&lossprob);
   printf("Enter packet corruption probability [0.0 for no corruption]:");
   scanf("%f",&corruptprob);
-  if (lossprob != 0.0 || corruptprob != 0.0) {
+  if (gilbert && ge_corruptbad < 0.0)
+    ge_corruptbad = corruptprob;  /* bad state corrupts like the good one */
+  if (lossprob != 0.0 || corruptprob != 0.0 || gilbert || replayfile) {
     printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
     scanf("%d",&corruptdirection);
   }
@@ -195,9 +1578,15 @@ void init(void)                         /* initialize the simulator */
   scanf("%f",&lambda);
   printf("Enter TRACE:");
   scanf("%d",&TRACE);
+  if (nthreads > 1 && TRACE > 0) {
+    printf("\nthe two threads would mix their trace lines: use -t 1 to trace\n");
+    exit(EXIT_FAILURE);
+  }
 
 
   srand(9999);              /* init random number generator */
+  streams[A] = 9999;        /* and the two of -i */
+  streams[B] = 19997;
   sum = 0.0;                /* test random number generator for students */
   for (i=0; i<1000; i++)
     sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
@@ -215,150 +1604,379 @@ void init(void)                         /* initialize the simulator */
   packets_resent = 0;
   new_ACKs = 0;
   packets_received = 0;
+  fec_recovered = 0;
+  retx_recovered = 0;
+  mode_switches = 0;
+  parity_sent = 0;
+  bytes_sentA = 0;
+  parity_bytes = 0;
   packets_lost = 0;  
   packets_corrupt = 0;
   packets_sent = 0;
   packets_timeout = 0;
   messages_delivered = 0;
+  bytes_delivered = 0;
+  packets_reordered = packets_expired = 0;
+  rcv_buffer_max = 0;
+  lastarrival[A] = lastarrival[B] = 0.0;
+  gestate[A] = gestate[B] = GOOD;
+  ge_badpkts = 0;
+  lossrun[A] = lossrun[B] = 0;
+  nbursts = 0;
+  burstmax = 0;
+  for (i = 0; i < BURSTHIST; i++)
+    bursthist[i] = 0;
+  if (replayfile)
+    openreplay();
+  if (telefile) {
+    telemetry = fopen(telefile, "w");
+    if (telemetry == NULL) {
+      printf("cannot write %s\n", telefile);
+      exit(EXIT_FAILURE);
+    }
+    fprintf(telemetry, "time,events,queue,timer,fromlayer5,fromlayer3,"
+            "inflightAB,inflightBA,unacked,buffered\n");
+  }
+  nextsample = teltime;
+  nevents_done = 0;
+  nsamples = 0;
+  for (i = 0; i < 4; i++)
+    evmix[i] = 0;
+  inflight[A] = inflight[B] = 0;
+  unacked_packets = 0;
+  buffered_packets = 0;
 
   ntolayer3 = 0;
   nlost = 0;
   ncorrupt = 0;
 
-  time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
+  flows = calloc(nflows, sizeof(struct flow));
+  if (flows == NULL) {
+    printf("memory allocation for connections failed.");
+    exit(EXIT_FAILURE);
+  }
+  if (srcfile) {
+    opensource();
+    for (i = 0; i < nflows; i++)
+      flows[i].rcvhash = FNV_OFFSET;
+  }
+  if (sinkfile)
+    opensink();
+  if (livefile)
+    openlive();
+  if (gen == NULL)
+    gen = generators;
+  if (arrfile)
+    openarrivals();
+  simtime=0.0;                    /* initialize time to 0.0 */
+  if (gen->next == gen_onoff)     /* every connection starts in an on period */
+    for (i = 0; i < nflows; i++)
+      flows[i].onuntil = pareto(ontime);
+
+  for (i = 0; i < nflows; i++)
+    generate_next_arrival(i);     /* initialize event list */
 }
 
 /********************** Student-callable ROUTINES ***********************/
 
 /* called by students routine to cancel a previously-started timer */
-void stoptimer(int AorB)
+void stoptimer(int AorB, int conn)
 /* A or B is trying to stop timer */
 {
   struct event *q;
+  PROF_DECL(t);
 
+  PROF_START(t);
   if (TRACE>1)
-    printf("          STOP TIMER: stopping timer at %f\n",time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      /* remove this event */
-      if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
-      else if (q->next==NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
-        q->next->prev=NULL;
-        evlist = q->next;
-      }
-      else {     /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next =  q->next;
-      }
-      free(q);
-      return;
-    }
-  printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    printf("          STOP TIMER: stopping timer at %f\n",simtime);
+  q = flows[conn].timer[AorB];
+  if (q == NULL) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    PROF_STOP(PROF_STOPTIMER, t);
+    return;
+  }
+  removeevent(q);
+  freeevent(q);
+  flows[conn].timer[AorB] = NULL;
+  PROF_STOP(PROF_STOPTIMER, t);
 }
 
 
-void starttimer(int AorB, double increment)
+void starttimer(int AorB, int conn, double increment)
 /* A or B is trying to start timer */
 {
-
-  struct event *q;
   struct event *evptr;
+  PROF_DECL(t);
 
+  PROF_START(t);
   if (TRACE>1)
-    printf("          START TIMER: starting timer at %f\n",time);
+    printf("          START TIMER: starting timer at %f\n",simtime);
   /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
-    }
+  if (flows[conn].timer[AorB] != NULL) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    PROF_STOP(PROF_STARTTIMER, t);
+    return;
+  }
  
   /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + increment;
+  evptr = newevent();
+  evptr->evtime =  simtime + increment;
   evptr->evtype =  TIMER_INTERRUPT;
-   
- 
   evptr->eventity = AorB;
+  evptr->conn = conn;
+  evptr->timerid = NOTIMER;
+  flows[conn].timer[AorB] = evptr;
   insertevent(evptr);
+  PROF_STOP(PROF_STARTTIMER, t);
 } 
 
+/* stoptimer() for the named timer id */
+void stoptimer_id(int AorB, int conn, int id)
+{
+  struct event **slot = timerslot(AorB, conn, id);
+  PROF_DECL(t);
+
+  PROF_START(t);
+  if (TRACE>1)
+    printf("          STOP TIMER: stopping timer %d at %f\n", id, simtime);
+  if (*slot == NULL) {
+    printf("Warning: unable to cancel timer %d. It wasn't running.\n", id);
+    PROF_STOP(PROF_STOPTIMER, t);
+    return;
+  }
+  removeevent(*slot);
+  freeevent(*slot);
+  *slot = NULL;
+  PROF_STOP(PROF_STOPTIMER, t);
+}
+
+/* starttimer() for the named timer id; others may be running */
+void starttimer_id(int AorB, int conn, int id, double increment)
+{
+  struct event **slot = timerslot(AorB, conn, id);
+  struct event *evptr;
+  PROF_DECL(t);
+
+  PROF_START(t);
+  if (nthreads > 1 && AorB == B) {  /* timer_fired would be shared by both threads */
+    printf("with -t 2 only A can use named timers\n");
+    exit(EXIT_FAILURE);
+  }
+  if (TRACE>1)
+    printf("          START TIMER: starting timer %d at %f\n", id, simtime);
+  if (*slot != NULL) {
+    printf("Warning: attempt to start timer %d that is already started\n", id);
+    PROF_STOP(PROF_STARTTIMER, t);
+    return;
+  }
+  evptr = newevent();
+  evptr->evtime = simtime + increment;
+  evptr->evtype = TIMER_INTERRUPT;
+  evptr->eventity = AorB;
+  evptr->conn = conn;
+  evptr->timerid = id;
+  *slot = evptr;
+  insertevent(evptr);
+  PROF_STOP(PROF_STARTTIMER, t);
+}
+
+
+/* extra delay of a packet that is allowed to overtake the ones in front */
+double jittersample(void)
+{
+  double u, x;
+  int i;
+
+  switch (jitterdist) {
+  case JITTER_EXPONENTIAL:
+    return -jitter * log(1.0 - jimsrand() * 0.999999);
+  case JITTER_NORMAL:       /* mean jitter, std dev jitter/2, never negative */
+    for (u = 0.0, i = 0; i < 12; i++)
+      u += jimsrand();
+    x = jitter + (u - 6.0) * jitter / 2;
+    return x > 0.0 ? x : 0.0;
+  default:                  /* uniform on [0,2*jitter] */
+    return 2 * jitter * jimsrand();
+  }
+}
+
+/* a run of lost packets from AorB has just ended, record it */
+void endburst(int AorB)
+{
+  int len = lossrun[AorB];
+
+  if (len == 0)
+    return;
+  nbursts++;
+  if (len > burstmax)
+    burstmax = len;
+  bursthist[len < BURSTHIST ? len - 1 : BURSTHIST - 1]++;
+  lossrun[AorB] = 0;
+}
+
+/* does the channel drop this packet from AorB?  With the Gilbert-Elliott */
+/* model the channel first moves one step of its two state Markov chain.  */
+int channellost(int AorB)
+{
+  int affected, lost;
+
+  affected = !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+  if (replay) {
+    currec = NULL;
+    if (affected && replaynext == nreplay) {
+      if (replayloop)
+        replaynext = 0;
+      else
+        replayended = 1;
+    }
+    if (affected && !replayended) {
+      currec = &replay[replaynext++];
+      replayused++;
+    }
+    lost = currec != NULL && currec->drop;
+  }
+  else if (!gilbert)
+    lost = jimsrand() < lossprob && affected;
+  else if (!affected)
+    lost = 0;
+  else {
+    if (gestate[AorB] == GOOD && jimsrand() < ge_pgb)
+      gestate[AorB] = BAD;
+    else if (gestate[AorB] == BAD && jimsrand() < ge_pbg)
+      gestate[AorB] = GOOD;
+    if (gestate[AorB] == BAD)
+      ge_badpkts++;
+    lost = jimsrand() < (gestate[AorB] == BAD ? ge_lossbad : lossprob);
+  }
+
+  if (lost)
+    lossrun[AorB]++;
+  else
+    endburst(AorB);
+  return lost;
+}
+
+/* does the channel corrupt this packet from AorB? */
+int channelcorrupts(int AorB)
+{
+  int affected;
+
+  affected = !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+  if (replay)
+    return currec != NULL && currec->corrupt;
+  if (!gilbert)
+    return jimsrand() < corruptprob && affected;
+  return affected &&
+    jimsrand() < (gestate[AorB] == BAD ? ge_corruptbad : corruptprob);
+}
 
 /************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
+void tolayer3(int AorB, int conn, struct pkt packet)
 /* A or B is sending to network  */
 {
   struct pkt *mypktptr;
-  struct event *evptr,*q;
+  struct event *evptr;
   float lastime, x;
   int i;
+  PROF_DECL(t);
 
+  /* before anything is counted or drawn, so a bad length always fails */
+  if (packet.length < 0 || packet.length > MAXPAYLOAD) {
+    printf("TOLAYER3: packet length %d is out of range\n", packet.length);
+    exit(EXIT_FAILURE);
+  }
+
+  PROF_START(t);
   ntolayer3++;
+  if (AorB == A) {
+    flows[conn].datasent++;
+    bytes_sentA += PKT_USED(packet);
+    if (packet.flags & PKT_PARITY) {
+      parity_sent++;
+      parity_bytes += PKT_USED(packet);
+    }
+  }
 
   /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
+  if (channellost(AorB)) {
     nlost++;
     if (TRACE>0)    
       printf("          TOLAYER3: packet being lost\n");
+    PROF_STOP(PROF_TOLAYER3, t);
     return;
   }  
 
   /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
+  /* to do something with the packet after we return back to him/her.      */
+  /* Only the header and the bytes of payload in use are kept.             */
+  mypktptr = newpkt(packet.length);
+  memcpy(mypktptr, &packet, PKT_USED(packet));
   if (TRACE>2)  {
     printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
            mypktptr->acknum,  mypktptr->checksum);
-    for (i=0; i<20; i++)
+    for (i=0; i<mypktptr->length; i++)
       printf("%c",mypktptr->payload[i]);
     printf("\n");
   }
 
   /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
+  evptr = newevent();
   evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
   evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
+  evptr->conn = conn;
   evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
+  evptr->pktno = flows[conn].pktssent[evptr->eventity]++;
+  if (nhops > 0) {                /* it reaches the nearest router first */
+    evptr->evtype = FROM_ROUTER;
+    evptr->hop = AorB == A ? 0 : nhops - 1;
+  }
   /* finally, compute the arrival time of packet at the other end.
      medium can not reorder, so make sure packet arrives between 1 and 10
      time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
+     currently in the medium on their way to the destination
+     (all connections share the medium).
+     In reordering mode some packets skip the queue and only see
+     the jitter, so they may arrive before packets sent earlier,
+     and a packet that would arrive more than MAXLIFETIME from now
+     is lost instead (it does not hold up the queue either).
+     A replayed delay counts from now, as recorded; it is only
+     stretched when the packet would otherwise overtake another. */
+  if (reorderprob > 0.0 && jimsrand() < reorderprob)
+    evptr->evtime = simtime + (currec && currec->delay >= 0 ? currec->delay : 1 + jittersample());
+  else if (currec && currec->delay >= 0) {
+    evptr->evtime = simtime + currec->delay;
+    if (evptr->evtime < lastarrival[evptr->eventity])
+      evptr->evtime = lastarrival[evptr->eventity];
+  }
+  else {
+    lastime = simtime;
+    if (lastarrival[evptr->eventity] > lastime)
+      lastime = lastarrival[evptr->eventity];
+    evptr->evtime =  lastime + 1 + 9*jimsrand();
+  }
+  if (reorderprob > 0.0 && evptr->evtime - simtime > MAXLIFETIME) {
+    nlost++;
+    packets_expired++;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being lost, it would arrive too late\n");
+    freepkt(mypktptr);
+    freeevent(evptr);
+    PROF_STOP(PROF_TOLAYER3, t);
+    return;
+  }
+  if (evptr->evtime > lastarrival[evptr->eventity])
+    lastarrival[evptr->eventity] = evptr->evtime;
  
 
 
   /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
+  if (channelcorrupts(AorB)) {
     ncorrupt++;
-    if ( (x = jimsrand()) < .75)
+    if (currec)   /* the replay file says what to corrupt */
+      x = currec->corrupt == REPLAY_CORRUPT_SEQ ? .8 : currec->corrupt == REPLAY_CORRUPT_ACK ? .9 : 0.0;
+    else
+      x = jimsrand();
+    if (x < .75 && mypktptr->length > 0)
       mypktptr->payload[0]='Z';   /* corrupt payload */
     else if (x < .875)
       mypktptr->seqnum = 999999;
@@ -371,108 +1989,629 @@ void tolayer3(int AorB, struct pkt packet)
   if (TRACE>2)  
     printf("          TOLAYER3: scheduling arrival on other side\n");
   insertevent(evptr);
+  inflight[AorB]++;
+  PROF_STOP(PROF_TOLAYER3, t);
 } 
 
-void tolayer5(int AorB, char datasent[20])
+/* A packet reaches router evptr->hop.  It is lost, dropped for want of */
+/* room in the queue, or queued: once the packets ahead of it and then   */
+/* it have been sent, it goes on to the next router or to the far end.   */
+void forward(struct event *evptr)
+{
+  struct router *r = &routers[evptr->hop];
+  int from = 1 - evptr->eventity;
+  struct hopqueue *q = &hopq[evptr->hop][from];
+  struct event *next;
+  float start;
+  char *why;
+
+  while (q->count > 0 && q->departs[q->head] <= simtime) {
+    q->head = (q->head + 1) % MAXQUEUE;
+    q->count--;
+  }
+  q->arrived++;
+  if (evptr->pktptr->flags & PKT_RETX)
+    q->resent++;
+  q->queuesum += q->count;
+  if (q->count >= r->qlimit) {
+    q->overflowed++;
+    why = "dropped, the queue is full";
+  }
+  else if (r->loss > 0.0 && jimsrand() < r->loss) {
+    q->lost++;
+    why = "lost";
+  }
+  else
+    why = NULL;
+  if (why) {
+    if (TRACE>0)
+      printf("          ROUTER %d: packet being %s\n", evptr->hop + 1, why);
+    inflight[from]--;
+    freepkt(evptr->pktptr);
+    return;
+  }
+
+  next = newevent();
+  *next = *evptr;
+  start = q->count > 0 ? q->departs[(q->head + q->count - 1) % MAXQUEUE] : simtime;
+  q->departs[(q->head + q->count) % MAXQUEUE] = start + r->service;
+  if (++q->count > q->maxqueue)
+    q->maxqueue = q->count;
+  q->forwarded++;
+  next->evtime = start + r->service + r->delay;
+  next->hop += from == A ? 1 : -1;
+  if (next->hop < 0 || next->hop >= nhops)
+    next->evtype = FROM_LAYER3;
+  if (TRACE>2)
+    printf("          ROUTER %d: packet queued behind %d others, sent on at %f\n",
+           evptr->hop + 1, q->count - 1, start + r->service);
+  insertevent(next);
+}
+
+/* two sided 95% quantiles of Student's t for 1..30 degrees of freedom */
+static const double tquantile[30] = {
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+/* half-width of the 95% confidence interval of the -E metric, from the */
+/* means of the nbatches (at least 2) batches completed so far           */
+double halfwidth(void)
+{
+  double mean, var;
+
+  mean = bmsum / nbatches;
+  var = (bmsumsq - nbatches * mean * mean) / (nbatches - 1);
+  if (var < 0.0)
+    var = 0.0;
+  return (nbatches <= 31 ? tquantile[nbatches - 2] : 1.960) * sqrt(var / nbatches);
+}
+
+/* A message has reached B's layer 5: add it to the current batch, and */
+/* when the batch is full see whether the metric is known well enough.  */
+/* Batch means are treated as independent samples, which holds once a  */
+/* batch spans many round trips.                                        */
+void batchdeliver(int conn, int length)
+{
+  struct flow *f = &flows[conn];
+  double mean;
+
+  if (stopmetric == STOP_LATENCY) {
+    if (f->acccount == 0)   /* cannot tell when it was sent */
+      return;
+    batchsum += simtime - f->accepted[f->accfirst];
+    f->accfirst = (f->accfirst + 1) % ACCEPTQ;
+    f->acccount--;
+  }
+  else
+    batchsum += length;
+  if (++batchmsgs < batchsize)
+    return;
+  if (stopmetric == STOP_LATENCY)
+    mean = batchsum / batchmsgs;
+  else if (simtime > batchstart)
+    mean = batchsum / (simtime - batchstart);
+  else
+    return;                 /* no time has passed, let the batch grow */
+  nbatches++;
+  bmsum += mean;
+  bmsumsq += mean * mean;
+  batchmsgs = 0;
+  batchsum = 0.0;
+  batchstart = simtime;
+  if (nbatches >= MINBATCHES && halfwidth() <= stoptarget * fabs(bmsum / nbatches))
+    converged = 1;
+}
+
+/* A_output() accepted a message of connection conn just now */
+void accepted(int conn)
+{
+  struct flow *f = &flows[conn];
+
+  if (f->acccount == ACCEPTQ) {     /* not expected: forget the oldest */
+    f->accfirst = (f->accfirst + 1) % ACCEPTQ;
+    f->acccount--;
+  }
+  f->accepted[(f->accfirst + f->acccount++) % ACCEPTQ] = simtime;
+}
+
+/* B's application reads at readrate whenever it has something to read, */
+/* so what it has not read yet only needs working out when asked for     */
+int layer5_unread(int AorB, int conn)
+{
+  struct flow *f = &flows[conn];
+
+  if (!flow_control || AorB == A)
+    return 0;
+  f->unread -= readrate * (simtime - f->readtime);
+  if (f->unread < 0.0)
+    f->unread = 0.0;
+  f->readtime = simtime;
+  return (int)ceil(f->unread);
+}
+
+void tolayer5(int AorB, int conn, char *datasent, int length)
 {
   int i;  
+  PROF_DECL(t);
+
+  PROF_START(t);
   if (TRACE>2) {
     printf("          TOLAYER5: data received by application at ");
     if (AorB == A) 
       printf("A: ");
     else
       printf("B: ");
-    for (i=0; i<20; i++)  
+    for (i=0; i<length; i++)  
       printf("%c",datasent[i]);
     printf("\n");
   }
   messages_delivered++;
+  bytes_delivered += length;
+  flows[conn].delivered++;
+  flows[conn].bytes += length;
+  if (srcdata && AorB == B) {
+    flows[conn].rcvhash = fnv(flows[conn].rcvhash, datasent, length);
+    flows[conn].rcvbytes += length;
+  }
+  if (sinkfd >= 0 && AorB == B)
+    sinkappend(datasent, length);
+  if (flow_control && AorB == B) {
+    layer5_unread(B, conn);
+    flows[conn].unread += length;
+    if (flows[conn].unread > maxunread)
+      maxunread = flows[conn].unread;
+  }
+  if (stopmetric && AorB == B)
+    batchdeliver(conn, length);
+  PROF_STOP(PROF_TOLAYER5, t);
 }
 
-int main(void)
+/* per connection results and how fairly the channel was shared.  Every */
+/* connection is listed when there are only a few of them.               */
+void printflows(void)
 {
-  struct event *eventptr;
-  struct msg  msg2give;
-  struct pkt  pkt2give;
-   
-  int i,j;
-  
-  init();
-  A_init();
-  B_init();
-   
-  while (1) {
-    eventptr = evlist;            /* get next event to simulate */
-    if (eventptr==NULL)
-      goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
-    if (TRACE>=2) {
-      printf("\nEVENT time: %f,",eventptr->evtime);
-      printf("  type: %d",eventptr->evtype);
-      if (eventptr->evtype==0)
-        printf(", timerinterrupt  ");
-      else if (eventptr->evtype==1)
-        printf(", fromlayer5 ");
-      else
-        printf(", fromlayer3 ");
-      printf(" entity: %d\n",eventptr->eventity);
-    }
-    time = eventptr->evtime;        /* update time to next event time */
-    if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
-        /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
-          printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
-            printf("%c", msg2give.data[i]);
-          printf("\n");
+  int i, minflow, maxflow;
+  double sum, sumsq, x;
+
+  if (nflows <= 32) {
+    printf("conn  generated  delivered     bytes  packets sent by A\n");
+    for (i = 0; i < nflows; i++)
+      printf("%4d  %9d  %9d  %8lu  %d\n", i, flows[i].generated,
+             flows[i].delivered, flows[i].bytes, flows[i].datasent);
+  }
+  sum = sumsq = 0.0;
+  minflow = maxflow = 0;
+  for (i = 0; i < nflows; i++) {
+    x = flows[i].bytes;
+    sum += x;
+    sumsq += x * x;
+    if (flows[i].bytes < flows[minflow].bytes)
+      minflow = i;
+    if (flows[i].bytes > flows[maxflow].bytes)
+      maxflow = i;
+  }
+  printf("bytes delivered per connection:  min %lu (conn %d), mean %f, max %lu (conn %d) \n",
+         flows[minflow].bytes, minflow, sum / nflows, flows[maxflow].bytes, maxflow);
+  /* Jain's index: 1 when every connection got the same, 1/n when one got it all */
+  printf("fairness index over %d connections:  %f \n", nflows,
+         sumsq > 0.0 ? sum * sum / (nflows * sumsq) : 1.0);
+}
+
+/* per router and direction: where packets were dropped and how long */
+/* the queues got                                                      */
+void printhops(void)
+{
+  struct hopqueue *q;
+  int i, j, lost = 0;
+
+  printf("router  from  arrived  resent  lost  overflowed  forwarded  max queue  mean queue\n");
+  for (i = 0; i < nhops; i++)
+    for (j = A; j <= B; j++) {
+      q = &hopq[i][j];
+      printf("%6d  %4s  %7d  %6d  %4d  %10d  %9d  %9d  %10.3f\n", i + 1, j == A ? "A" : "B",
+             q->arrived, q->resent, q->lost, q->overflowed, q->forwarded, q->maxqueue,
+             q->arrived > 0 ? q->queuesum / q->arrived : 0.0);
+      lost += q->lost + q->overflowed;
+    }
+  printf("number of packets dropped by the %d routers:  %d \n", nhops, lost);
+}
+
+/* take one event off the queue and hand it to whoever it is for */
+void handle(struct event *eventptr)
+{
+  static PERTHREAD struct msg  msg2give;
+  static PERTHREAD struct pkt  pkt2give;
+  int i,j,full,limited;
+
+  curside = eventptr->eventity;
+  nevents_done++;
+  evmix[eventptr->evtype]++;
+  if (TRACE>=2) {
+    printf("\nEVENT time: %f,",eventptr->evtime);
+    printf("  type: %d",eventptr->evtype);
+    if (eventptr->evtype==0)
+      printf(", timerinterrupt  ");
+    else if (eventptr->evtype==1)
+      printf(", fromlayer5 ");
+    else if (eventptr->evtype==FROM_ROUTER)
+      printf(", fromrouter %d ", eventptr->hop + 1);
+    else
+      printf(", fromlayer3 ");
+    printf(" entity: %d",eventptr->eventity);
+    if (nflows > 1)
+      printf(" conn: %d",eventptr->conn);
+    printf("\n");
+  }
+  simtime = eventptr->evtime;        /* update time to next event time */
+  if (eventptr->evtype == FROM_LAYER5 ) {
+    if (nsim < nsimmax) {
+      if (gen->next != gen_saturate)
+        generate_next_arrival(eventptr->conn);   /* set up future arrival */
+      /* fill in msg to give with string of same letter */    
+      j = nsim % 26; 
+      if (srcdata)
+        sourcemsg(eventptr->conn, &msg2give);
+      else {
+        msg2give.length = msgsize;
+        memset(msg2give.data, 97 + j, msgsize);
+      }
+      if (TRACE>2) {
+        printf("          MAINLOOP: data given to student: ");
+        for (i=0; i<msg2give.length; i++) 
+          printf("%c", msg2give.data[i]);
+        printf("\n");
+      }
+      nsim++;
+      flows[eventptr->conn].generated++;
+      if (eventptr->eventity == A) {
+        full = window_full;
+        limited = flow_limited;
+        PROF_CALL(PROF_A_OUTPUT, A_output(eventptr->conn, msg2give));
+        if (stopmetric == STOP_LATENCY && window_full == full)
+          accepted(eventptr->conn);
+        if (srcdata && window_full == full) {   /* else offer the same bytes again */
+          flows[eventptr->conn].srcbytes += msg2give.length;
+          flows[eventptr->conn].srcpos = (flows[eventptr->conn].srcpos + msg2give.length) % srcsize;
+        }
+        if (gen->next == gen_saturate) {
+          if (window_full == full)
+            generate_next_arrival(eventptr->conn);
+          else {            /* not sent yet: offered again after A's next event */
+            window_full = full;     /* so not a drop either */
+            flow_limited = limited;
+            nsim--;
+            flows[eventptr->conn].generated--;
+            flows[eventptr->conn].blocked = 1;
+          }
         }
-        nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
-        else
-          B_output(msg2give);  
       }
-      else if (TRACE > 2)
-          printf("          FROM_LAYER5: no more messages to send: \n");
-    }
-    else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
+      else
+        B_output(eventptr->conn, msg2give);  
+    }
+    else if (TRACE > 2)
+        printf("          FROM_LAYER5: no more messages to send: \n");
+  }
+  else if (eventptr->evtype ==  FROM_LAYER3) {
+    memcpy(&pkt2give, eventptr->pktptr, PKT_USED(*eventptr->pktptr));
+    inflight[1 - eventptr->eventity]--;
+    if (eventptr->pktno < flows[eventptr->conn].pktsseen[eventptr->eventity])
+      packets_reordered++;
+    else
+      flows[eventptr->conn].pktsseen[eventptr->eventity] = eventptr->pktno + 1;
 	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
+      PROF_CALL(PROF_A_INPUT, A_input(eventptr->conn, pkt2give));   /* appropriate entity */
+    else
+      PROF_CALL(PROF_B_INPUT, B_input(eventptr->conn, pkt2give));
+	    freepkt(eventptr->pktptr);       /* keep the memory for the next packet */
+  }
+  else if (eventptr->evtype == FROM_ROUTER)
+    forward(eventptr);
+  else if (eventptr->evtype ==  TIMER_INTERRUPT) {
+    if (eventptr->timerid == NOTIMER)
+      flows[eventptr->conn].timer[eventptr->eventity] = NULL;
+    else {  /* only named timers touch timer_fired, which -t 2 leaves to A */
+      flows[eventptr->conn].timers[eventptr->eventity][eventptr->timerid] = NULL;
+      timer_fired = eventptr->timerid;
+    }
+    if (eventptr->eventity == A) 
+      PROF_CALL(PROF_A_TIMER, A_timerinterrupt(eventptr->conn));
+    else
+      B_timerinterrupt(eventptr->conn);
+    if (eventptr->timerid != NOTIMER)
+      timer_fired = NOTIMER;
+  }
+  else  {
+    printf("INTERNAL PANIC: unknown event type \n");
+  }
+  /* A may have room now for the message a saturating source is holding */
+  if (flows[eventptr->conn].blocked && eventptr->eventity == A
+      && eventptr->evtype != FROM_LAYER5 && eventptr->evtype != FROM_ROUTER) {
+    flows[eventptr->conn].blocked = 0;
+    generate_next_arrival(eventptr->conn);
+  }
+  freeevent(eventptr);
+}
+
+#ifdef PARALLEL
+/* -t 2.  Everything that happens at A is one stream of events and         */
+/* everything at B another, and they only meet through packets, which      */
+/* spend at least LOOKAHEAD in the channel (-P, which could deliver        */
+/* sooner, is not allowed).  So when T is the earliest event pending on    */
+/* either side, both can handle everything before T + LOOKAHEAD without    */
+/* hearing from the other: whatever they send arrives after that.  Each    */
+/* side's thread runs such a window over its own heap, then, between two   */
+/* barriers, takes the packets the other sent during it and both work out  */
+/* the next window.  The bound is rounded to a float like the event times, */
+/* so a packet sent at T or later is never due before it.  With -i the     */
+/* result is the one a sequential run gives; -U and -H are kept by         */
+/* ending a window at the warm-up and stopping both at the horizon.        */
+#define LOOKAHEAD 1.0
+
+void *runside(void *arg)
+{
+  struct side *s = arg, *other;
+  int warm = warmedup, i;
+  float t;
+  float end;
+
+  curside = s == &sides[A] ? A : B;
+  other = &sides[1 - curside];
+  while (1) {
+    pthread_barrier_wait(&barrier);     /* both are done with the last window */
+    for (i = 0; i < other->nout; i++)
+      heapinsert(other->outbox[i]);
+    other->nout = 0;
+    s->next = nevents > 0 ? evheap[0]->evtime : -1.0;
+    pthread_barrier_wait(&barrier);     /* and know the other's next event */
+    if (sides[B].next < 0.0 || (sides[A].next >= 0.0 && sides[A].next < sides[B].next))
+      t = sides[A].next;
+    else
+      t = sides[B].next;
+    if (t < 0.0 || (horizon > 0.0 && t > horizon))
+      break;
+    if (warmup > 0.0 && !warm && t >= warmup) {
+      if (curside == A)
+        resetstats();
       else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
+        resetcounts();
+      warm = 1;
+      pthread_barrier_wait(&barrier);   /* nothing is counted before both are reset */
     }
-    else if (eventptr->evtype ==  TIMER_INTERRUPT) {
-      if (eventptr->eventity == A) 
-        A_timerinterrupt();
+    end = (float)(t + LOOKAHEAD);
+    if (warmup > 0.0 && !warm && end > warmup)
+      end = warmup;
+    while (nevents > 0 && evheap[0]->evtime < end
+           && !(horizon > 0.0 && evheap[0]->evtime > horizon))
+      handle(nextevent());
+    if (curside == A)
+      nwindows++;
+  }
+  s->clock = simtime;
+  s->events = nevents_done;
+  s->ntolayer3 = ntolayer3;
+  s->nlost = nlost;
+  s->ncorrupt = ncorrupt;
+  s->ge_badpkts = ge_badpkts;
+  s->nbursts = nbursts;
+  s->burstmax = burstmax;
+  for (i = 0; i < BURSTHIST; i++)
+    s->bursthist[i] = bursthist[i];
+  s->packets_reordered = packets_reordered;
+  s->packets_expired = packets_expired;
+  s->inflight[A] = inflight[A];
+  s->inflight[B] = inflight[B];
+  return NULL;
+}
+
+/* Run A's side on this thread and B's on another, then add B's PERTHREAD */
+/* counters to this thread's, which the report reads.                     */
+void runparallel(void)
+{
+  struct side *b = &sides[B];
+  pthread_t bthread;
+  int i;
+
+  pthread_barrier_init(&barrier, NULL, 2);
+  if (pthread_create(&bthread, NULL, runside, b) != 0) {
+    printf("cannot start B's thread\n");
+    exit(EXIT_FAILURE);
+  }
+  runside(&sides[A]);
+  pthread_join(bthread, NULL);
+  pthread_barrier_destroy(&barrier);
+
+  if (horizon > 0.0 && (sides[A].next > horizon || b->next > horizon))
+    simtime = horizon;
+  else if (b->clock > simtime)
+    simtime = b->clock;
+  nevents_done += b->events;
+  ntolayer3 += b->ntolayer3;
+  nlost += b->nlost;
+  ncorrupt += b->ncorrupt;
+  ge_badpkts += b->ge_badpkts;
+  nbursts += b->nbursts;
+  if (b->burstmax > burstmax)
+    burstmax = b->burstmax;
+  for (i = 0; i < BURSTHIST; i++)
+    bursthist[i] += b->bursthist[i];
+  packets_reordered += b->packets_reordered;
+  packets_expired += b->packets_expired;
+  inflight[A] += b->inflight[A];
+  inflight[B] += b->inflight[B];
+}
+#endif
+
+int main(int argc, char **argv)
+{
+  struct event *eventptr;
+  clock_t started;
+  double cpusecs;
+  float now;
+   
+  int i;
+  
+  init(argc, argv);
+  started = clock();
+  A_init(nflows);
+  B_init(nflows);
+  if (resumefile)
+    loadcheckpoint();
+#ifdef PARALLEL
+  if (nthreads > 1) {
+    runparallel();
+    goto terminate;
+  }
+#endif
+   
+  while (nevents > 0) {
+    now = evheap[0]->evtime;
+    if (ckptfile && now >= ckpttime) {
+      savecheckpoint();
+      if (ckptevery > 0.0)
+        while (ckpttime <= now)
+          ckpttime += ckptevery;
       else
-        B_timerinterrupt();
+        ckptfile = NULL;
+    }
+    if (warmup > 0.0 && !warmedup && now >= warmup)
+      resetstats();
+    if (horizon > 0.0 && now > horizon) {
+      simtime = horizon;
+      goto terminate;
     }
-    else  {
-      printf("INTERNAL PANIC: unknown event type \n");
+    /* the state since the last event holds at every sample time before this one */
+    while (telemetry && teltime > 0.0 && now >= nextsample) {
+      sample(nextsample);
+      nextsample += teltime;
     }
-    free(eventptr);
+    /* Every event due now, in the order the heap gives them.  Events   */
+    /* these schedule for now, and timers they stop, are seen by the    */
+    /* next pop, so the order is what it would be one event at a time;  */
+    /* the checks above and publish() are done once for all of them.    */
+    do {
+      PROF_CALL(PROF_NEXTEVENT, eventptr = nextevent());  /* get next event to simulate */
+      handle(eventptr);
+      if (telemetry && televery > 0 && nevents_done % televery == 0)
+        sample(simtime);
+      if (converged || replayended || (eventcap > 0 && nevents_done >= eventcap))
+        goto terminate;
+    } while (nevents > 0 && evheap[0]->evtime == now);
+    if (live)
+      publish(1);
   }
 
  terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
+  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",simtime,nsim);
   printf("number of messages dropped due to full window:  %d \n", window_full);
   printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
   printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
   printf("number of packet resends by A:  %d \n", packets_resent);
   printf("number of correct packets received at B:  %d \n", packets_received);
   printf("number of messages delivered to application:  %d \n", messages_delivered);
+  endburst(A);
+  endburst(B);
+  if (nlost > 0) {
+    printf("number of packets lost in the channel:  %d in %d bursts, mean burst %f, longest %d \n",
+           nlost, nbursts, (double)nlost / nbursts, burstmax);
+    printf("loss burst lengths:");
+    for (i = 0; i < BURSTHIST - 1; i++)
+      printf("  %d:%d", i + 1, bursthist[i]);
+    printf("  %d+:%d \n", BURSTHIST, bursthist[BURSTHIST - 1]);
+  }
+  if (nflows > 1)
+    printflows();
+  if (nhops > 0)
+    printhops();
+  if (warmedup)
+    printf("statistics cover time %f to %f, the warm-up before that is left out \n",
+           statstart, simtime);
+  else if (warmup > 0.0)
+    printf("the run ended during the warm-up, the statistics cover all of it \n");
+  if (horizon > 0.0 && simtime >= horizon)
+    printf("run stopped at the horizon, time %f \n", horizon);
+  else if (horizon > 0.0)
+    printf("run ended before the horizon: layer 5 ran out of messages, the drain is included \n");
+  if (gen != generators) {
+    printf("traffic generator:  %s", gen->name);
+    if (gen->next == gen_onoff)
+      printf(" (a message every %g during on periods of mean %g, off periods of mean %g, shape %g)",
+             lambda, ontime, offtime, onshape);
+    else if (gen->next == gen_trace)
+      printf(" (%ld timestamps from %s)", narrtimes, arrfile);
+    printf(" \n");
+  }
+  if (replay)
+    printf("number of replay records used:  %ld (file holds %ld)%s \n", replayused, nreplay,
+           replayended ? " (run stopped at the end of the file)" : "");
+  if (gilbert)
+    printf("number of packets sent while the channel was in the bad state:  %d \n", ge_badpkts);
+  if (reorderprob > 0.0) {
+    printf("number of packets delivered out of order by the network:  %d \n", packets_reordered);
+    printf("number of packets lost for taking longer than %d to arrive:  %d \n",
+           MAXLIFETIME, packets_expired);
+  }
+  if (retx_mode == RETX_ADAPTIVE)
+    printf("number of switches between GBN and SR retransmission:  %d \n", mode_switches);
+  if (flow_control) {
+    printf("number of messages refused because B's advertised window was too small:  %d \n",
+           flow_limited);
+    printf("number of zero window probes sent by A:  %d \n", window_probes);
+    printf("most bytes waiting to be read by B's application at once:  %.0f \n", maxunread);
+  }
+  if (nak_holdoff > 0) {
+    printf("number of missing packets named in NAKs by B:  %d \n", naks_sent);
+    printf("number of packet resends by A after a NAK:  %d, after a timeout:  %d \n",
+           nak_resends, timeout_resends);
+  }
+  if (stopmetric && nbatches >= 2)
+    printf("%s:  %f +- %f (95%% confidence, %d batches of %d messages), %s \n",
+           stopmetric == STOP_GOODPUT ? "goodput per batch (bytes per time unit)"
+                                      : "latency (time units from A_output to delivery)",
+           bmsum / nbatches, halfwidth(), nbatches, batchsize,
+           converged ? "run stopped early" : "target not reached");
+  else if (stopmetric)
+    printf("too few batches of %d messages for a confidence interval \n", batchsize);
+  if (eventcap > 0 && nevents_done >= eventcap && !converged)
+    printf("run stopped after %ld events \n", nevents_done);
+#ifdef PARALLEL
+  if (nthreads > 1)
+    printf("synchronisation windows of A's and B's threads:  %ld (%.1f events each) \n",
+           nwindows, nwindows > 0 ? (double)nevents_done / nwindows : 0.0);
+#endif
+  if (live) {
+    live->wallsecs = wallclock() - live->started;
+    publish(0);
+    munmap(live, sizeof(struct livestats));
+    printf("live statistics left in %s \n", livefile);
+  }
+  if (telemetry) {
+    sample(simtime);
+    fclose(telemetry);
+    printf("number of telemetry samples written to %s:  %ld \n", telefile, nsamples);
+  }
+  if (fec_k > 0) {
+    printf("number of FEC parity packets sent by A:  %d (%.1f%% of the bytes A sent)\n",
+           parity_sent, bytes_sentA > 0 ? 100.0 * parity_bytes / bytes_sentA : 0.0);
+    printf("number of packets recovered by FEC at B:  %d \n", fec_recovered);
+    printf("number of packets recovered by retransmission at B:  %d \n", retx_recovered);
+  }
+  printf("most packets held in the receive buffer at once:  %d \n", rcv_buffer_max);
+  cpusecs = (double)(clock() - started) / CLOCKS_PER_SEC;
+  printf("number of bytes delivered to application:  %lu \n", bytes_delivered);
+  if (simtime > statstart)
+    printf("goodput (bytes per simulated time unit):  %f \n",
+           bytes_delivered / (simtime - statstart));
+  if (cpusecs > 0.0)
+    printf("goodput (bytes per CPU second):  %.0f \n", bytes_delivered / cpusecs);
+  if (srcdata)
+    printsource(cpusecs);
+  if (sinkfd >= 0) {
+    closesink();
+    printf("number of delivered bytes written to %s:  %lu in %lu writes \n",
+           sinkfile, sinkbytes, sinkwrites);
+  }
+  PROF_DUMP();
   return EXIT_SUCCESS;
 }
\ No newline at end of file
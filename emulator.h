@@ -1,40 +1,177 @@
-extern int TRACE;
-
-/* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
-
-#define   A    0
-#define   B    1
-
-/* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
-/* 4 (students' code).  It contains the data (characters) to be delivered */
-/* to layer 5 via the students transport level protocol entities.         */
-struct msg {
-  char data[20];
-};
-
-/* a packet is the data unit passed from layer 4 (students code) to layer */
-/* 3 (teachers code).  Note the pre-defined packet structure, which all   */
-/* students must follow. */
-struct pkt {
-  int seqnum;
-  int acknum;
-  int checksum;
-  char payload[20];
-};
-
-/* send to A or B (int), packet to send */
-extern void tolayer3(int, struct pkt);  
-
-/* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]); 
-
-/* start timer at A or B (int), increment */
-extern void starttimer(int, double);       
-
-/* stop timer at A or B (int) */
-extern void stoptimer(int);               
+#include <stddef.h>
+
+extern int TRACE;
+
+/* statistics updated by GBN */
+extern int total_ACKs_received;
+extern int packets_resent;       /* count of the number of packets resent  */
+extern int new_ACKs;      /* count of the number of acks correctly received */
+extern int packets_received;  /* count of the packets received by receiver */
+extern int window_full; /* count of the number of messages dropped due to full window */
+extern int rcv_buffer_max; /* most packets ever held in the receive buffer at once */
+extern int fec_recovered;  /* packets B rebuilt from parity instead of waiting for a resend */
+extern int retx_recovered; /* packets B first got from a retransmission */
+extern int mode_switches;  /* times an adaptive sender changed how it resends */
+extern int unacked_packets;  /* packets all senders are holding until they are ACKed */
+extern int buffered_packets; /* packets all receivers are holding until a gap is filled */
+extern int naks_sent;        /* missing packets B named in NAKs */
+extern int nak_resends;      /* packets A resent because B NAKed them */
+extern int timeout_resends;  /* packets A resent because its timer went off */
+extern int flow_limited;     /* messages A refused because B's advertised window was too small */
+extern int window_probes;    /* zero window probes A sent */
+
+#define   A    0
+#define   B    1
+
+/* largest payload a single packet can carry.  The MTU actually used by a
+   run is chosen at startup (-m) and may be anything from 1 up to this. */
+#ifndef MAXPAYLOAD
+#define MAXPAYLOAD 1024
+#endif
+
+/* largest message layer 5 may hand down in one go.  Messages bigger than
+   the MTU are split into several packets by the sender and put back
+   together by the receiver before delivery. */
+#ifndef MAXMSG
+#define MAXMSG (8*MAXPAYLOAD)
+#endif
+
+/* A FIFO channel (the default) delivers an old copy of a packet before
+   any packet sent after it.  When it reorders (-r) it bounds how late a
+   copy can turn up instead: a packet it would take more than MAXLIFETIME
+   time units to deliver is lost.  Every packet takes at least 1. */
+#define MAXLIFETIME 30
+
+extern int mtu;           /* payload bytes per packet for this run */
+extern int msgsize;       /* bytes in each message from layer 5, at most */
+extern int fec_k;         /* data packets per parity packet, 0 for no FEC */
+extern int retx_mode;     /* how A resends after a timeout, RETX_xxx */
+extern int window_size;   /* packets in A's window, 0 for the protocol's default */
+extern int nak_holdoff;   /* 0: no NAKs, else packets B receives before NAKing a gap again */
+extern int flow_control;  /* B's application reads slowly and B advertises its room in ACKs */
+
+/* retransmission strategies (-R) */
+#define RETX_SR        0  /* only the packet that timed out */
+#define RETX_GBN       1  /* every unacknowledged packet in the window */
+#define RETX_ADAPTIVE  2  /* GBN while the link looks clean, SR under loss */
+
+/* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
+/* 4 (students' code).  It contains the data (characters) to be delivered */
+/* to layer 5 via the students transport level protocol entities.         */
+/* Only the first length bytes of data are meaningful.                     */
+struct msg {
+  int length;
+  char data[MAXMSG];
+};
+
+/* a packet is the data unit passed from layer 4 (students code) to layer */
+/* 3 (teachers code).  Note the pre-defined packet structure, which all   */
+/* students must follow.  Only the first length bytes of payload are      */
+/* meaningful, and the checksum must cover the length and flags fields.  */
+struct pkt {
+  int seqnum;
+  int acknum;
+  int checksum;
+  int length;
+  int flags;
+  char payload[MAXPAYLOAD];
+};
+
+/* pkt flags */
+#define PKT_EOM     0x1   /* last segment of a layer 5 message */
+#define PKT_PARITY  0x2   /* XOR of the fec_k data packets from seqnum on */
+#define PKT_RETX    0x4   /* sent again after a timeout */
+#define PKT_NAK     0x8   /* ACK whose payload lists the seqnums B is missing, the low byte of each */
+#define PKT_PROBE   0x10  /* no data, asks B to send its window */
+
+/* With flow_control, the flags of every ACK also carry B's window: the
+   packets it has room for from the start of its receive window on. */
+#define PKT_WINDOW_SHIFT  8
+#define PKT_WINDOW(p)     (((p).flags >> PKT_WINDOW_SHIFT) & 0xff)
+
+/* number of bytes of a packet that are actually in use */
+#define PKT_HDRLEN        offsetof(struct pkt, payload)
+#define PKT_USED(p)       (PKT_HDRLEN + (size_t)(p).length)
+
+/* A replay file (-T) holds the channel's decision for each packet handed */
+/* to tolayer3(), one record per packet in the order they are sent, after */
+/* the 8 byte REPLAY_MAGIC header.  Records are in native byte order.     */
+struct replayrec {
+  unsigned char drop;     /* non-zero: the packet is lost */
+  unsigned char corrupt;  /* REPLAY_CORRUPT_xxx, or 0 for none */
+  unsigned char unused[2];
+  float delay;            /* one way delay from when the packet is sent, made */
+                          /* longer only if the packet would overtake one     */
+                          /* sent before it; negative: use the random delay   */
+};
+
+#define REPLAY_MAGIC        "EMUREPL1"
+#define REPLAY_CORRUPT_DATA 1     /* overwrite the first payload byte */
+#define REPLAY_CORRUPT_SEQ  2     /* overwrite the sequence number */
+#define REPLAY_CORRUPT_ACK  3     /* overwrite the acknowledgement number */
+
+/* A live statistics file (-M) is a struct livestats that the emulator  */
+/* keeps mapped and updates once the events due at each simulated time   */
+/* have been handled; livestats.c reads it while the run goes on.  The   */
+/* emulator makes seq odd before it changes anything and even again     */
+/* afterwards, so a reader that sees the same even seq before and after  */
+/* copying the struct has a consistent copy.                             */
+struct livestats {
+  char magic[8];                  /* LIVE_MAGIC */
+  unsigned long seq;
+  int running;                    /* 0 once the run has terminated */
+  double started;                 /* wall clock time the run began, seconds since 1970 */
+  double wallsecs;                /* how long it took, once it has terminated */
+  double simtime;
+  unsigned long events;           /* events handled */
+  int queue;                      /* events pending */
+  int nsim;                       /* messages from layer 5 so far */
+  int messages_delivered;
+  unsigned long bytes_delivered;
+  int packets_resent;
+  int new_ACKs;
+  int packets_received;
+  int window_full;
+  int packets_lost;
+  int packets_corrupted;
+  int unacked_packets;
+  int buffered_packets;
+};
+
+#define LIVE_MAGIC          "EMULIVE1"
+
+/* Several connections can share the emulated channel (-n).  Each one is */
+/* identified by an int from 0 up to the count given to A_init/B_init,    */
+/* and every call below says which connection it is made for.             */
+
+/* send to A or B (int), connection, packet to send */
+extern void tolayer3(int, int, struct pkt);
+
+/* deliver to A or B (int), connection, data to deliver, number of bytes */
+extern void tolayer5(int, int, char *, int);
+
+/* bytes delivered to A or B (int), connection, that the application */
+/* there has not read yet; always 0 without flow_control                */
+extern int layer5_unread(int, int);
+
+/* start timer at A or B (int), connection, increment */
+extern void starttimer(int, int, double);
+
+/* stop timer at A or B (int), connection */
+extern void stoptimer(int, int);
+
+/* Named timers, for a protocol that wants several running at once, such */
+/* as one per packet.  Each has an id from 0 up to MAXTIMERS-1, separate  */
+/* from the timer above.  When one goes off, A_timerinterrupt() or        */
+/* B_timerinterrupt() is called with timer_fired set to its id; for the   */
+/* timer of starttimer() it is NOTIMER.  Only emulator.c has them.        */
+#define MAXTIMERS  256
+#define NOTIMER    (-1)
+
+extern int timer_fired;
+
+/* start timer id at A or B (int), connection, increment */
+extern void starttimer_id(int, int, int, double);
+
+/* stop timer id at A or B (int), connection */
+extern void stoptimer_id(int, int, int);
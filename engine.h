@@ -0,0 +1,43 @@
+/* Several builds of sr.c (or gbn.c), each compiled for its own window
+   size, can be linked into one program, and engines.c picks one of them
+   at startup.  Built with -DENGINE=name, every external symbol of the
+   protocol gets name_ in front, so the builds do not clash:
+
+     gcc -c -O2 -DNTRACE -DWINDOWSIZE=8 -DENGINE=w8 -o sr_w8.o sr.c
+
+   Without ENGINE nothing is renamed. */
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#ifdef ENGINE
+#define ENGINE_CAT2(engine, name) engine##_##name
+#define ENGINE_CAT(engine, name)  ENGINE_CAT2(engine, name)
+
+#define A_init                ENGINE_CAT(ENGINE, A_init)
+#define A_input               ENGINE_CAT(ENGINE, A_input)
+#define A_output              ENGINE_CAT(ENGINE, A_output)
+#define A_timerinterrupt      ENGINE_CAT(ENGINE, A_timerinterrupt)
+#define B_init                ENGINE_CAT(ENGINE, B_init)
+#define B_input               ENGINE_CAT(ENGINE, B_input)
+#define B_output              ENGINE_CAT(ENGINE, B_output)
+#define B_timerinterrupt      ENGINE_CAT(ENGINE, B_timerinterrupt)
+#define save_state            ENGINE_CAT(ENGINE, save_state)
+#define restore_state         ENGINE_CAT(ENGINE, restore_state)
+#define ComputeChecksum       ENGINE_CAT(ENGINE, ComputeChecksum)
+#define IsCorrupted           ENGINE_CAT(ENGINE, IsCorrupted)
+#define backoff               ENGINE_CAT(ENGINE, backoff)
+#define deliver_segment       ENGINE_CAT(ENGINE, deliver_segment)
+#define fec_add               ENGINE_CAT(ENGINE, fec_add)
+#define fec_rebuild           ENGINE_CAT(ENGINE, fec_rebuild)
+#define find_buffer_index     ENGINE_CAT(ENGINE, find_buffer_index)
+#define find_earliest_unacked ENGINE_CAT(ENGINE, find_earliest_unacked)
+#define nak_gaps              ENGINE_CAT(ENGINE, nak_gaps)
+#define nak_resend            ENGINE_CAT(ENGINE, nak_resend)
+#define observe               ENGINE_CAT(ENGINE, observe)
+#define probe_window          ENGINE_CAT(ENGINE, probe_window)
+#define rcv_room              ENGINE_CAT(ENGINE, rcv_room)
+#define resend                ENGINE_CAT(ENGINE, resend)
+#define send_window           ENGINE_CAT(ENGINE, send_window)
+#endif
+
+#endif
@@ -0,0 +1,65 @@
+/* ******************************************************************
+   WINDOW SIZE SPECIALISED PROTOCOL BUILDS
+
+   Links several builds of sr.c (or gbn.c) into one program, and the
+   emulator calls one of them, picked when A_init() is called:
+
+     for w in 4 6 8 16 32; do
+       gcc -c -O2 -DNTRACE -DWINDOWSIZE=$w -DENGINE=w$w -o sr_w$w.o sr.c
+     done
+     gcc -c -O2 -DRUNTIME_WINDOW -DENGINE=wn -o sr_wn.o sr.c
+     gcc -O2 -DENGINES -o sr_fast emulator.c engines.c sr_w*.o -lm
+
+   In the fixed builds the window and sequence space are constants, so
+   wrapping around them is a mask for powers of two and a multiply for
+   the rest, and with NTRACE every trace branch is gone.  The build for
+   -W is used (DEFAULTWINDOW when -W is not given); the runtime sized one
+   (wn) takes any other window, and every run with TRACE above 0 so that
+   the trace still comes out.
+**********************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include "emulator.h"
+#include "engines.h"
+
+#define DEFAULTWINDOW 6   /* as in sr.c and gbn.c */
+
+#define DECLARE(e) \
+  extern void e##_A_init(int); \
+  extern void e##_B_init(int); \
+  extern void e##_A_input(int, struct pkt); \
+  extern void e##_B_input(int, struct pkt); \
+  extern void e##_A_output(int, struct msg); \
+  extern void e##_A_timerinterrupt(int); \
+  extern void e##_B_output(int, struct msg); \
+  extern void e##_B_timerinterrupt(int); \
+  extern void e##_save_state(FILE *); \
+  extern int e##_restore_state(FILE *);
+
+DECLARE(w4)
+DECLARE(w6)
+DECLARE(w8)
+DECLARE(w16)
+DECLARE(w32)
+DECLARE(wn)
+
+#define ENGINE(e, window) { window, e##_A_init, e##_B_init, e##_A_input, e##_B_input, \
+    e##_A_output, e##_A_timerinterrupt, e##_B_output, e##_B_timerinterrupt, \
+    e##_save_state, e##_restore_state }
+
+static const struct engine engines[] = {
+  ENGINE(w4, 4), ENGINE(w6, 6), ENGINE(w8, 8), ENGINE(w16, 16), ENGINE(w32, 32),
+  ENGINE(wn, 0)             /* last: takes whatever the others do not */
+};
+
+const struct engine *engine;     /* the build in use */
+
+/* called by A_init(): the build for -W, or the runtime sized one */
+void choose_engine(void)
+{
+  int window = window_size ? window_size : DEFAULTWINDOW;
+
+  for (engine = engines; engine->window != 0; engine++)
+    if (engine->window == window && TRACE <= 0)
+      break;
+}
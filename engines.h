@@ -0,0 +1,38 @@
+/* The protocol entry points of one build of sr.c or gbn.c, and the build
+   engines.c picked for this run.  With -DENGINES the emulator includes
+   this after the protocol's header, so that every call goes straight
+   through a pointer: a wrapper function would copy each struct msg and
+   struct pkt a second time, which costs more than the specialised builds
+   save. */
+#ifndef ENGINES_H
+#define ENGINES_H
+
+struct engine {
+  int window;               /* window it was compiled for, 0: any */
+  void (*A_init)(int);
+  void (*B_init)(int);
+  void (*A_input)(int, struct pkt);
+  void (*B_input)(int, struct pkt);
+  void (*A_output)(int, struct msg);
+  void (*A_timerinterrupt)(int);
+  void (*B_output)(int, struct msg);
+  void (*B_timerinterrupt)(int);
+  void (*save_state)(FILE *);
+  int (*restore_state)(FILE *);
+};
+
+extern const struct engine *engine;
+extern void choose_engine(void);
+
+#define A_init(nconns)            (choose_engine(), engine->A_init(nconns))
+#define B_init(nconns)            engine->B_init(nconns)
+#define A_input(conn, packet)     engine->A_input(conn, packet)
+#define B_input(conn, packet)     engine->B_input(conn, packet)
+#define A_output(conn, message)   engine->A_output(conn, message)
+#define A_timerinterrupt(conn)    engine->A_timerinterrupt(conn)
+#define B_output(conn, message)   engine->B_output(conn, message)
+#define B_timerinterrupt(conn)    engine->B_timerinterrupt(conn)
+#define save_state(f)             engine->save_state(f)
+#define restore_state(f)          engine->restore_state(f)
+
+#endif
@@ -1,380 +1,548 @@
-#include <stdlib.h>
-#include <stdio.h>
-#include <stdbool.h>
-#include "emulator.h"
-#include "sr.h"
-
-/* ******************************************************************
-   Selective Repeat protocol.  Adapted from J.F.Kurose Go-Back-N
-   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2  
-
-   Network properties:
-   - one way network delay averages five time units (longer if there
-   are other messages in the channel for GBN), but can be larger
-   - packets can be corrupted (either the header or the data portion)
-   or lost, according to user-defined probabilities
-   - packets will be delivered in the order in which they were sent
-   (although some can be lost).
-
-   Modifications: 
-   - removed bidirectional GBN code and other code not used by prac. 
-   - fixed C style to adhere to current programming style
-   - added Selective Repeat implementation
-**********************************************************************/
-
-#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE 7      /* the min sequence space for SR must be at least windowsize + 1 */
-#define NOTINUSE (-1)   /* used to fill header fields that are not being used */
-#define UNACKED (0)     /* packet has not been acknowledged */
-#define ACKED (1)       /* packet has been acknowledged */
-
-/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
-   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
-   original checksum.  This procedure must generate a different checksum to the original if
-   the packet is corrupted.
-*/
-int ComputeChecksum(struct pkt packet)
-{
-  int checksum = 0;
-  int i;
-
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ ) 
-    checksum += (int)(packet.payload[i]);
-
-  return checksum;
-}
-
-bool IsCorrupted(struct pkt packet)
-{
-  if (packet.checksum == ComputeChecksum(packet))
-    return (false);
-  else
-    return (true);
-}
-
-
-/********* Sender (A) variables and functions ************/
-
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
-
-/* SR specific variables for sender */
-static int ack_status[WINDOWSIZE];     /* track if packet is acknowledged */
-static float timer_values[WINDOWSIZE]; /* track individual timer for each packet */
-static int active_timers;              /* count of active timers */
-
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
-{
-  struct pkt sendpkt;
-  int i;
-
-  /* if not blocked waiting on ACK */
-  if (windowcount < WINDOWSIZE) {
-    if (TRACE > 1)
-      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
-
-    /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for (i=0; i<20; i++) 
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt); 
-
-    /* put packet in window buffer */
-    windowlast = (windowlast + 1) % WINDOWSIZE; 
-    buffer[windowlast] = sendpkt;
-    windowcount++;
-    
-    /* mark packet as unacknowledged */
-    ack_status[windowlast] = UNACKED;
-
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3(A, sendpkt);
-
-    /* start timer if no active timers */
-    if (active_timers == 0) {
-      starttimer(A, RTT);
-    }
-    active_timers++;
-    timer_values[windowlast] = RTT;
-
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
-  }
-  /* if blocked, window is full */
-  else {
-    if (TRACE > 0)
-      printf("----A: New message arrives, send window is full\n");
-    window_full++;
-  }
-}
-
-/* called from layer 3, when a packet arrives for layer 4 
-   In this practical this will always be an ACK as B never sends data.
-*/
-void A_input(struct pkt packet)
-{
-  int i;
-  int buffer_index = -1;
-  int seqfirst, seqlast;
-
-  /* if received ACK is not corrupted */ 
-  if (!IsCorrupted(packet)) {
-    if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
-    total_ACKs_received++;
-
-    /* Find the packet being acknowledged in the window buffer */
-    for (i = 0; i < windowcount; i++) {
-      int idx = (windowfirst + i) % WINDOWSIZE;
-      if (buffer[idx].seqnum == packet.acknum) {
-        buffer_index = idx;
-        break;
-      }
-    }
-
-    /* If packet is in window and not already acknowledged */
-    if (buffer_index != -1 && ack_status[buffer_index] == UNACKED) {
-      if (TRACE > 0)
-        printf("----A: ACK %d is not a duplicate\n", packet.acknum);
-      new_ACKs++;
-      
-      /* Mark packet as acknowledged */
-      ack_status[buffer_index] = ACKED;
-      
-      /* Decrement active timer count */
-      active_timers--;
-      
-      /* If all packets are acknowledged, slide window to beginning of unacknowledged packets */
-      if (buffer_index == windowfirst) {
-        /* Slide window past consecutive ACKed packets */
-        while (windowcount > 0 && ack_status[windowfirst] == ACKED) {
-          windowfirst = (windowfirst + 1) % WINDOWSIZE;
-          windowcount--;
-        }
-      }
-      
-      /* Restart timer if there are still unacknowledged packets */
-      if (windowcount > 0) {
-        /* Stop current timer */
-        stoptimer(A);
-        
-        /* Find next unacknowledged packet to time */
-        if (active_timers > 0) {
-          starttimer(A, RTT);
-        }
-      }
-      else {
-        /* All packets acknowledged, stop timer */
-        stoptimer(A);
-      }
-    }
-    else {
-      /* Duplicate ACK or packet not in window */
-      if (TRACE > 0 && buffer_index == -1)
-        printf("----A: duplicate ACK received, do nothing!\n");
-    }
-  }
-  else {
-    if (TRACE > 0)
-      printf("----A: corrupted ACK is received, do nothing!\n");
-  }
-}
-
-/* called when A's timer goes off */
-void A_timerinterrupt(void)
-{
-  int i;
-  int resent = 0;
-
-  if (TRACE > 0)
-    printf("----A: time out,resend packets!\n");
-
-  /* Find unacknowledged packets and retransmit */
-  for (i = 0; i < windowcount; i++) {
-    int idx = (windowfirst + i) % WINDOWSIZE;
-    if (ack_status[idx] == UNACKED) {
-      if (TRACE > 0)
-        printf("---A: resending packet %d\n", buffer[idx].seqnum);
-      
-      tolayer3(A, buffer[idx]);
-      packets_resent++;
-      resent = 1;
-    }
-  }
-  
-  /* Reset timer if packets were resent */
-  if (resent) {
-    starttimer(A, RTT);
-  }
-}       
-
-
-/* the following routine will be called once (only) before any other */
-/* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
-{
-  int i;
-  
-  /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.  
-                      new packets are placed in winlast + 1 
-                      so initially this is set to -1
-                    */
-  windowcount = 0;
-  
-  /* initialize SR specific variables */
-  for (i = 0; i < WINDOWSIZE; i++) {
-    ack_status[i] = UNACKED;
-    timer_values[i] = 0.0;
-  }
-  active_timers = 0;
-}
-
-
-/********* Receiver (B) variables and procedures ************/
-
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
-
-/* SR specific variables for receiver */
-static struct pkt rcv_buffer[WINDOWSIZE];  /* buffer for out-of-order packets */
-static int buffer_status[WINDOWSIZE];      /* track if buffer position is occupied */
-static int rcv_base;                       /* base of receive window */
-
-void B_input(struct pkt packet)
-{
-  struct pkt sendpkt;
-  int i;
-  int rel_seqnum;
-  int buffer_index;
-
-  /* if not corrupted */
-  if (!IsCorrupted(packet)) {
-    /* Check if packet is within receive window */
-    rel_seqnum = packet.seqnum - rcv_base;
-    if (rel_seqnum < 0)
-      rel_seqnum += SEQSPACE;
-      
-    if (rel_seqnum < WINDOWSIZE) {
-      /* Packet is within receive window */
-      packets_received++;  /* Count all correctly received packets */
-      
-      if (TRACE > 0)
-        printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
-      
-      buffer_index = rel_seqnum;
-      
-      /* Store packet if not already buffered */
-      if (buffer_status[buffer_index] == 0) {
-        rcv_buffer[buffer_index] = packet;
-        buffer_status[buffer_index] = 1;
-        
-        /* If this is the expected packet, deliver it and any consecutive buffered packets */
-        if (packet.seqnum == expectedseqnum) {
-          /* Deliver the expected packet */
-          tolayer5(B, packet.payload);
-          buffer_status[0] = 0;
-          
-          /* Update expected sequence number */
-          expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
-          rcv_base = (rcv_base + 1) % SEQSPACE;
-          
-          /* Deliver consecutive buffered packets */
-          while (buffer_status[0] == 1) {
-            tolayer5(B, rcv_buffer[0].payload);
-            buffer_status[0] = 0;
-            
-            /* Shift buffer */
-            for (i = 0; i < WINDOWSIZE - 1; i++) {
-              rcv_buffer[i] = rcv_buffer[i + 1];
-              buffer_status[i] = buffer_status[i + 1];
-            }
-            buffer_status[WINDOWSIZE - 1] = 0;
-            
-            /* Update expected sequence number */
-            expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
-            rcv_base = (rcv_base + 1) % SEQSPACE;
-          }
-        }
-      }
-      
-      /* Send ACK for the received packet */
-      sendpkt.acknum = packet.seqnum;
-    }
-    else {
-      /* Packet is outside window - send ACK for last in-order packet received */
-      if (TRACE > 0)
-        printf("----B: packet %d is outside window, send ACK for last in-order packet\n", packet.seqnum);
-      
-      /* ACK the packet that is one before expected */
-      if (expectedseqnum == 0)
-        sendpkt.acknum = SEQSPACE - 1;
-      else
-        sendpkt.acknum = expectedseqnum - 1;
-    }
-  }
-  else {
-    /* Packet is corrupted - send ACK for last in-order packet received */
-    if (TRACE > 0)
-      printf("----B: packet is corrupted, send ACK for last in-order packet\n");
-    
-    /* ACK the packet that is one before expected */
-    if (expectedseqnum == 0)
-      sendpkt.acknum = SEQSPACE - 1;
-    else
-      sendpkt.acknum = expectedseqnum - 1;
-  }
-
-  /* create ACK packet */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
-    
-  /* we don't have any data to send. fill payload with 0's */
-  for (i = 0; i < 20; i++) 
-    sendpkt.payload[i] = '0';  
-
-  /* compute checksum */
-  sendpkt.checksum = ComputeChecksum(sendpkt); 
-
-  /* send out ACK packet */
-  tolayer3(B, sendpkt);
-}
-
-void B_init(void)
-{
-  int i;
-  
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
-  
-  /* initialize SR specific variables */
-  rcv_base = 0;
-  for (i = 0; i < WINDOWSIZE; i++) {
-    buffer_status[i] = 0;
-  }
-}
-
-/******************************************************************************
- * The following functions need be completed only for bi-directional messages *
- *****************************************************************************/
-
-/* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)  
-{
-}
-
-/* called when B's timer goes off */
-void B_timerinterrupt(void)
-{
-}
\ No newline at end of file
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "emulator.h"
+#include "prof.h"
+#include "engine.h"
+#include "sr.h"
+
+/* ******************************************************************
+   Selective Repeat protocol.  Adapted from J.F.Kurose Go-Back-N
+   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2  
+
+   Network properties:
+   - one way network delay averages five time units (longer if there
+   are other messages in the channel for GBN), but can be larger
+   - packets can be corrupted (either the header or the data portion)
+   or lost, according to user-defined probabilities
+   - packets will be delivered in the order in which they were sent
+   (although some can be lost).
+
+   Modifications: 
+   - removed bidirectional GBN code and other code not used by prac. 
+   - fixed C style to adhere to current programming style
+   - added Selective Repeat implementation
+**********************************************************************/
+
+#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+#define UNACKED (0)     /* packet has not been acknowledged */
+#define ACKED (1)       /* packet has been acknowledged */
+
+/* The window is fixed when the protocol is compiled: WINDOWSIZE packets,
+   DEFAULTWINDOW unless built with -DWINDOWSIZE=n, and -W must then be n
+   or left out.  Built with -DRUNTIME_WINDOW it is window_size instead
+   (-W, up to MAXWINDOW), which is slower: every wrap around the window or
+   the sequence space tests the size and may divide, and every array is
+   MAXWINDOW long.  engines.c links several builds into one program and
+   picks one at startup. */
+#define DEFAULTWINDOW 6
+#define MAXWINDOW 64
+#ifdef RUNTIME_WINDOW
+#define WINDOWSIZE window_size
+#define WINDOWMAX MAXWINDOW
+#else
+#ifndef WINDOWSIZE
+#define WINDOWSIZE DEFAULTWINDOW   /* the maximum number of buffered unacked packet */
+#endif
+#define WINDOWMAX WINDOWSIZE
+#endif
+/* B buffers packets that arrive out of order, as SR's does, so it needs
+   the same sequence space: twice the window on a FIFO channel, and with
+   -r enough for MAXLIFETIME + 2 windows (see sr.c). */
+#define SEQSPACE (32 * WINDOWSIZE)
+#if MAXLIFETIME + 2 > 32
+#error "SEQSPACE is too small for the channel's MAXLIFETIME"
+#endif
+
+/* i % n for the non-negative i used here, a mask when n is a power of two */
+#define MODULO(i, n) (((n) & ((n) - 1)) == 0 ? (i) & ((n) - 1) : (i) % (n))
+
+/* After a timeout A resends the whole window, and waits twice as long
+   for the next one, up to MAXBACKOFF*RTT, until an ACK acknowledges
+   something new.  Otherwise, once the channel queues more than an RTT's
+   worth, every timeout adds a window to the queue and nothing gets
+   through. */
+#define MAXBACKOFF 64
+
+/* -DNTRACE builds a protocol that never traces: every TRACE test below is
+   then constant and compiled away */
+#ifdef NTRACE
+#define TRACE 0
+#endif
+
+/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
+   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
+   original checksum.  This procedure must generate a different checksum to the original if
+   the packet is corrupted.
+*/
+int ComputeChecksum(struct pkt packet)
+{
+  int checksum = 0;
+  int i;
+  PROF_DECL(t);
+
+  PROF_START(t);
+  checksum = packet.seqnum;
+  checksum += packet.acknum;
+  checksum += packet.length;
+  checksum += packet.flags;
+  for ( i=0; i<packet.length; i++ ) 
+    checksum += (int)(packet.payload[i]);
+
+  PROF_STOP(PROF_CHECKSUM, t);
+  return checksum;
+}
+
+bool IsCorrupted(struct pkt packet)
+{
+  if (packet.length < 0 || packet.length > MAXPAYLOAD)
+    return (true);
+  if (packet.checksum == ComputeChecksum(packet))
+    return (false);
+  else
+    return (true);
+}
+
+
+/********* Sender (A) variables and functions ************/
+
+/* sender state of one connection */
+struct sender {
+  struct pkt buffer[WINDOWMAX];    /* array for storing packets waiting for ACK */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int A_nextseqnum;               /* the next sequence number to be used by the sender */
+
+  /* SR specific variables for sender */
+  int ack_status[WINDOWMAX];      /* track if packet is acknowledged */
+  float timer_values[WINDOWMAX];   /* track individual timer for each packet */
+  int active_timers;              /* count of active timers */
+  double timeout;                 /* the timer's current timeout, see MAXBACKOFF */
+};
+
+static struct sender *senders;         /* one per connection */
+static int nsenders;
+
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+void A_output(int conn, struct msg message)
+{
+  struct sender *snd = &senders[conn];
+  struct pkt *sendpkt;
+  int nsegs, offset, seg;
+
+  /* a message bigger than the MTU goes out as several segments, each of
+     which needs its own slot in the window */
+  nsegs = (message.length + mtu - 1) / mtu;
+  if (nsegs < 1)
+    nsegs = 1;
+
+  /* if not blocked waiting on ACK */
+  if (snd->windowcount + nsegs <= WINDOWSIZE) {
+    if (TRACE > 1)
+      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
+
+    for (seg = 0, offset = 0; seg < nsegs; seg++, offset += mtu) {
+      /* create packet directly in the window buffer */
+      snd->windowlast = MODULO(snd->windowlast + 1, WINDOWSIZE); 
+      sendpkt = &snd->buffer[snd->windowlast];
+      sendpkt->seqnum = snd->A_nextseqnum;
+      sendpkt->acknum = NOTINUSE;
+      sendpkt->length = message.length - offset < mtu ? message.length - offset : mtu;
+      sendpkt->flags = (seg == nsegs - 1) ? PKT_EOM : 0;
+      memcpy(sendpkt->payload, message.data + offset, sendpkt->length);
+      sendpkt->checksum = ComputeChecksum(*sendpkt); 
+      snd->windowcount++;
+      unacked_packets++;
+    
+      /* mark packet as unacknowledged */
+      snd->ack_status[snd->windowlast] = UNACKED;
+
+      /* send out packet */
+      if (TRACE > 0)
+        printf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+      tolayer3(A, conn, *sendpkt);
+
+      /* start timer if no active timers */
+      if (snd->active_timers == 0) {
+        starttimer(A, conn, snd->timeout);
+      }
+      snd->active_timers++;
+      snd->timer_values[snd->windowlast] = RTT;
+
+      /* get next sequence number, wrap back to 0 */
+      snd->A_nextseqnum = MODULO(snd->A_nextseqnum + 1, SEQSPACE);  
+    }
+  }
+  /* if blocked, window is full */
+  else {
+    if (TRACE > 0)
+      printf("----A: New message arrives, send window is full\n");
+    window_full++;
+  }
+}
+
+/* called from layer 3, when a packet arrives for layer 4 
+   In this practical this will always be an ACK as B never sends data.
+*/
+void A_input(int conn, struct pkt packet)
+{
+  struct sender *snd = &senders[conn];
+  int i;
+  int buffer_index = -1;
+  int seqfirst, seqlast;
+
+  /* if received ACK is not corrupted */ 
+  if (!IsCorrupted(packet)) {
+    if (TRACE > 0)
+      printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
+    total_ACKs_received++;
+
+    /* Find the packet being acknowledged in the window buffer */
+    for (i = 0; i < snd->windowcount; i++) {
+      int idx = MODULO(snd->windowfirst + i, WINDOWSIZE);
+      if (snd->buffer[idx].seqnum == packet.acknum) {
+        buffer_index = idx;
+        break;
+      }
+    }
+
+    /* If packet is in window and not already acknowledged */
+    if (buffer_index != -1 && snd->ack_status[buffer_index] == UNACKED) {
+      if (TRACE > 0)
+        printf("----A: ACK %d is not a duplicate\n", packet.acknum);
+      new_ACKs++;
+      
+      /* Mark packet as acknowledged */
+      snd->ack_status[buffer_index] = ACKED;
+      
+      /* Decrement active timer count */
+      snd->active_timers--;
+      snd->timeout = RTT;
+      
+      /* If all packets are acknowledged, slide window to beginning of unacknowledged packets */
+      if (buffer_index == snd->windowfirst) {
+        /* Slide window past consecutive ACKed packets */
+        while (snd->windowcount > 0 && snd->ack_status[snd->windowfirst] == ACKED) {
+          snd->windowfirst = MODULO(snd->windowfirst + 1, WINDOWSIZE);
+          snd->windowcount--;
+          unacked_packets--;
+        }
+      }
+      
+      /* Restart timer if there are still unacknowledged packets */
+      if (snd->windowcount > 0) {
+        /* Stop current timer */
+        stoptimer(A, conn);
+        
+        /* Find next unacknowledged packet to time */
+        if (snd->active_timers > 0) {
+          starttimer(A, conn, RTT);
+        }
+      }
+      else {
+        /* All packets acknowledged, stop timer */
+        stoptimer(A, conn);
+      }
+    }
+    else {
+      /* Duplicate ACK or packet not in window */
+      if (TRACE > 0 && buffer_index == -1)
+        printf("----A: duplicate ACK received, do nothing!\n");
+    }
+  }
+  else {
+    if (TRACE > 0)
+      printf("----A: corrupted ACK is received, do nothing!\n");
+  }
+}
+
+/* called when A's timer goes off */
+void A_timerinterrupt(int conn)
+{
+  struct sender *snd = &senders[conn];
+  int i;
+  int resent = 0;
+
+  if (TRACE > 0)
+    printf("----A: time out,resend packets!\n");
+
+  /* Find unacknowledged packets and retransmit */
+  for (i = 0; i < snd->windowcount; i++) {
+    int idx = MODULO(snd->windowfirst + i, WINDOWSIZE);
+    if (snd->ack_status[idx] == UNACKED) {
+      if (TRACE > 0)
+        printf("---A: resending packet %d\n", snd->buffer[idx].seqnum);
+      
+      tolayer3(A, conn, snd->buffer[idx]);
+      packets_resent++;
+      resent = 1;
+    }
+  }
+  
+  /* Reset timer if packets were resent, backing off */
+  if (resent) {
+    if (snd->timeout < MAXBACKOFF * RTT)
+      snd->timeout *= 2;
+    starttimer(A, conn, snd->timeout);
+  }
+}       
+
+
+/* the following routine will be called once (only) before any other */
+/* entity A routines are called. You can use it to do any initialization */
+void A_init(int nconns)
+{
+  struct sender *snd;
+  int i, conn;
+
+#ifdef RUNTIME_WINDOW
+  if (window_size == 0)
+    window_size = DEFAULTWINDOW;
+  if (window_size < 1 || window_size > MAXWINDOW) {
+    printf("A_init: the window must be 1 to %d packets\n", MAXWINDOW);
+    exit(EXIT_FAILURE);
+  }
+#else
+  if (window_size != 0 && window_size != WINDOWSIZE) {
+    printf("A_init: built for a window of %d packets, build with -DWINDOWSIZE=%d\n",
+           WINDOWSIZE, window_size);
+    exit(EXIT_FAILURE);
+  }
+#endif
+  if ((msgsize + mtu - 1) / mtu > WINDOWSIZE) {
+    printf("A_init: a %d byte message takes %d packets of %d bytes, more than the window of %d\n",
+           msgsize, (msgsize + mtu - 1) / mtu, mtu, WINDOWSIZE);
+    exit(EXIT_FAILURE);
+  }
+  senders = calloc(nconns, sizeof(struct sender));
+  if (senders == NULL) {
+    printf("A_init: no memory for %d connections\n", nconns);
+    exit(EXIT_FAILURE);
+  }
+  nsenders = nconns;
+  for (conn = 0; conn < nconns; conn++) {
+    snd = &senders[conn];
+  
+    /* initialise A's window, buffer and sequence number */
+    snd->A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+    snd->windowfirst = 0;
+    snd->windowlast = -1;   /* windowlast is where the last packet sent is stored.  
+                        new packets are placed in winlast + 1 
+                        so initially this is set to -1
+                      */
+    snd->windowcount = 0;
+  
+    /* initialize SR specific variables */
+    for (i = 0; i < WINDOWSIZE; i++) {
+      snd->ack_status[i] = UNACKED;
+      snd->timer_values[i] = 0.0;
+    }
+    snd->active_timers = 0;
+    snd->timeout = RTT;
+  }
+}
+
+
+/********* Receiver (B) variables and procedures ************/
+
+/* receiver state of one connection */
+struct receiver {
+  int expectedseqnum; /* the sequence number expected next by the receiver */
+  int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+
+  /* SR specific variables for receiver */
+  struct pkt rcv_buffer[WINDOWMAX];    /* buffer for out-of-order packets */
+  int buffer_status[WINDOWMAX];        /* track if buffer position is occupied */
+  int held;                           /* number of them occupied */
+  int rcv_base;                       /* base of receive window */
+
+  /* reassembly of messages that were split into several segments */
+  char reassembly[MAXMSG];            /* segments received so far */
+  int reassembled;                    /* number of bytes in reassembly */
+};
+
+static struct receiver *receivers;     /* one per connection */
+static int nreceivers;
+
+/* hand an in-order segment up, layer 5 only ever sees whole messages */
+void deliver_segment(int conn, struct pkt *packet)
+{
+  struct receiver *rcv = &receivers[conn];
+
+  /* common case: a message that fitted in one packet */
+  if (rcv->reassembled == 0 && (packet->flags & PKT_EOM)) {
+    tolayer5(B, conn, packet->payload, packet->length);
+    return;
+  }
+
+  if (rcv->reassembled + packet->length > MAXMSG) {
+    if (TRACE > 0)
+      printf("----B: reassembled message too long, discarding\n");
+    rcv->reassembled = 0;
+    return;
+  }
+  memcpy(rcv->reassembly + rcv->reassembled, packet->payload, packet->length);
+  rcv->reassembled += packet->length;
+  if (packet->flags & PKT_EOM) {
+    tolayer5(B, conn, rcv->reassembly, rcv->reassembled);
+    rcv->reassembled = 0;
+  }
+}
+
+void B_input(int conn, struct pkt packet)
+{
+  struct receiver *rcv = &receivers[conn];
+  struct pkt sendpkt;
+  int i;
+  int rel_seqnum;
+  int buffer_index;
+  int held;
+
+  /* if not corrupted */
+  if (!IsCorrupted(packet)) {
+    /* Check if packet is within receive window */
+    rel_seqnum = packet.seqnum - rcv->rcv_base;
+    if (rel_seqnum < 0)
+      rel_seqnum += SEQSPACE;
+      
+    if (rel_seqnum < WINDOWSIZE) {
+      /* Packet is within receive window */
+      packets_received++;  /* Count all correctly received packets */
+      
+      if (TRACE > 0)
+        printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
+      
+      buffer_index = rel_seqnum;
+      
+      /* Store packet if not already buffered */
+      if (rcv->buffer_status[buffer_index] == 0) {
+        rcv->rcv_buffer[buffer_index] = packet;
+        rcv->buffer_status[buffer_index] = 1;
+        
+        /* If this is the expected packet (now in slot 0), deliver it and
+           any consecutive buffered packets, shifting after each one */
+        if (packet.seqnum == rcv->expectedseqnum) {
+          while (rcv->buffer_status[0] == 1) {
+            deliver_segment(conn, &rcv->rcv_buffer[0]);
+            rcv->buffer_status[0] = 0;
+            
+            /* Shift buffer */
+            for (i = 0; i < WINDOWSIZE - 1; i++) {
+              rcv->rcv_buffer[i] = rcv->rcv_buffer[i + 1];
+              rcv->buffer_status[i] = rcv->buffer_status[i + 1];
+            }
+            rcv->buffer_status[WINDOWSIZE - 1] = 0;
+            
+            /* Update expected sequence number */
+            rcv->expectedseqnum = MODULO(rcv->expectedseqnum + 1, SEQSPACE);
+            rcv->rcv_base = MODULO(rcv->rcv_base + 1, SEQSPACE);
+          }
+        }
+
+        /* whatever is left is waiting for a gap to be filled */
+        for (i = 0, held = 0; i < WINDOWSIZE; i++)
+          held += rcv->buffer_status[i];
+        if (held > rcv_buffer_max)
+          rcv_buffer_max = held;
+        buffered_packets += held - rcv->held;
+        rcv->held = held;
+      }
+      
+      /* Send ACK for the received packet */
+      sendpkt.acknum = packet.seqnum;
+    }
+    else {
+      /* Packet is outside window: a copy of one already delivered, whose
+         ACK may have been lost.  A waits for an ACK of that packet, so
+         send it again (with a sequence space of one more than the window
+         this was always the last in-order packet) */
+      if (TRACE > 0)
+        printf("----B: packet %d is outside window, send ACK for it again\n", packet.seqnum);
+      
+      sendpkt.acknum = packet.seqnum;
+    }
+  }
+  else {
+    /* Packet is corrupted - send ACK for last in-order packet received */
+    if (TRACE > 0)
+      printf("----B: packet is corrupted, send ACK for last in-order packet\n");
+    
+    /* ACK the packet that is one before expected */
+    if (rcv->expectedseqnum == 0)
+      sendpkt.acknum = SEQSPACE - 1;
+    else
+      sendpkt.acknum = rcv->expectedseqnum - 1;
+  }
+
+  /* create ACK packet */
+  sendpkt.seqnum = rcv->B_nextseqnum;
+  rcv->B_nextseqnum = (rcv->B_nextseqnum + 1) % 2;
+    
+  /* we don't have any data to send, so the ACK carries no payload */
+  sendpkt.length = 0;
+  sendpkt.flags = 0;
+
+  /* compute checksum */
+  sendpkt.checksum = ComputeChecksum(sendpkt); 
+
+  /* send out ACK packet */
+  tolayer3(B, conn, sendpkt);
+}
+
+void B_init(int nconns)
+{
+  struct receiver *rcv;
+  int i, conn;
+
+  receivers = calloc(nconns, sizeof(struct receiver));
+  if (receivers == NULL) {
+    printf("B_init: no memory for %d connections\n", nconns);
+    exit(EXIT_FAILURE);
+  }
+  nreceivers = nconns;
+  for (conn = 0; conn < nconns; conn++) {
+    rcv = &receivers[conn];
+  
+    rcv->expectedseqnum = 0;
+    rcv->B_nextseqnum = 1;
+  
+    /* initialize SR specific variables */
+    rcv->rcv_base = 0;
+    rcv->reassembled = 0;
+    rcv->held = 0;
+    for (i = 0; i < WINDOWSIZE; i++) {
+      rcv->buffer_status[i] = 0;
+    }
+  }
+}
+
+/******************************************************************************
+ * The following functions need be completed only for bi-directional messages *
+ *****************************************************************************/
+
+/* Note that with simplex transfer from a-to-B, there is no B_output() */
+void B_output(int conn, struct msg message)  
+{
+}
+
+/* called when B's timer goes off */
+void B_timerinterrupt(int conn)
+{
+}
+
+/* checkpoints: the state of every connection, written as it is in memory */
+void save_state(FILE *f)
+{
+  fwrite(senders, sizeof(struct sender), nsenders, f);
+  fwrite(receivers, sizeof(struct receiver), nreceivers, f);
+}
+
+int restore_state(FILE *f)
+{
+  if (fread(senders, sizeof(struct sender), nsenders, f) != (size_t)nsenders
+      || fread(receivers, sizeof(struct receiver), nreceivers, f) != (size_t)nreceivers)
+    return -1;
+  return 0;
+}
@@ -0,0 +1,122 @@
+/* livestats: show the statistics of an emulator run started with -M    */
+/* file while it goes on.                                                 */
+/*                                                                        */
+/*   usage: livestats file [seconds]                                      */
+/*                                                                        */
+/* Prints a line every second (or every given number of seconds) until   */
+/* the run terminates; with 0 it prints one line and stops.  Events per  */
+/* second are worked out from the change since the last line, and on the */
+/* first line from when the run began.  A run that was killed never says */
+/* it terminated: when the file has not changed for STALLED lines in a   */
+/* row, or stays half written for a second, livestats gives up on it.    */
+#define _POSIX_C_SOURCE 200112L   /* mmap() and nanosleep() */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "emulator.h"
+
+#define STALLED   5       /* intervals without an update before giving up */
+#define MAXTRIES  1000    /* copies tried, a millisecond apart */
+
+/* a consistent copy of *live, retrying while the emulator is writing it; */
+/* -1 if it never finishes, which means it was killed halfway through     */
+int snapshot(struct livestats *live, struct livestats *copy)
+{
+  struct timespec pause = { 0, 1000000 };
+  unsigned long seq;
+  int tries;
+
+  for (tries = 0; tries < MAXTRIES; tries++) {
+    seq = __atomic_load_n(&live->seq, __ATOMIC_ACQUIRE);
+    if (!(seq & 1)) {
+      memcpy(copy, live, sizeof(*copy));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&live->seq, __ATOMIC_RELAXED) == seq)
+        return 0;
+    }
+    nanosleep(&pause, NULL);
+  }
+  return -1;
+}
+
+/* seconds since 1970, as the emulator counts them */
+double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  struct livestats *live, cur;
+  struct timespec pause;
+  double interval = 1.0, then, t, rate;
+  unsigned long lastevents, lastseq;
+  int fd, stalled;
+
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: livestats file [seconds]\n");
+    return EXIT_FAILURE;
+  }
+  if (argc == 3)
+    interval = atof(argv[2]);
+  fd = open(argv[1], O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "livestats: cannot open %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  live = mmap(NULL, sizeof(struct livestats), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (live == MAP_FAILED || memcmp(live->magic, LIVE_MAGIC, sizeof(live->magic)) != 0) {
+    fprintf(stderr, "livestats: %s is not a live statistics file\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  pause.tv_sec = (time_t)interval;
+  pause.tv_nsec = (long)((interval - pause.tv_sec) * 1e9);
+
+  if (snapshot(live, &cur) != 0)
+    goto halfwritten;
+  then = now();
+  t = cur.running ? then - cur.started : cur.wallsecs;
+  lastevents = 0;
+  stalled = 0;
+  while (1) {
+    rate = t > 0.0 ? (cur.events - lastevents) / t : 0.0;
+    printf("time %.1f  events %lu (%.0f/s)  queue %d  msgs %d  delivered %d  bytes %lu"
+           "  resent %d  new ACKs %d  received %d  full %d  lost %d  corrupt %d"
+           "  unacked %d  buffered %d%s\n",
+           cur.simtime, cur.events, rate, cur.queue, cur.nsim, cur.messages_delivered,
+           cur.bytes_delivered, cur.packets_resent, cur.new_ACKs, cur.packets_received,
+           cur.window_full, cur.packets_lost, cur.packets_corrupted, cur.unacked_packets,
+           cur.buffered_packets, cur.running ? "" : "  (run finished)");
+    fflush(stdout);
+    if (!cur.running || interval <= 0.0)
+      break;
+    nanosleep(&pause, NULL);
+    lastevents = cur.events;
+    lastseq = cur.seq;
+    if (snapshot(live, &cur) != 0)
+      goto halfwritten;
+    if (cur.seq == lastseq && ++stalled >= STALLED) {
+      printf("livestats: %s has not changed for %d intervals, the run seems to have died\n",
+             argv[1], stalled);
+      return EXIT_FAILURE;
+    }
+    if (cur.seq != lastseq)
+      stalled = 0;
+    t = now() - then;
+    then += t;
+  }
+  return EXIT_SUCCESS;
+
+ halfwritten:
+  printf("livestats: %s stays half written, the run seems to have died while updating it\n",
+         argv[1]);
+  return EXIT_FAILURE;
+}
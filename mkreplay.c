@@ -0,0 +1,44 @@
+/* mkreplay: turn a text description of a channel into a replay file for */
+/* the emulator's -T option.                                              */
+/*                                                                        */
+/*   usage: mkreplay < decisions.txt > channel.rpl                        */
+/*                                                                        */
+/* Each input line describes one packet: drop (0/1), corrupt (0 none,     */
+/* 1 payload, 2 seqnum, 3 acknum) and the one way delay, or -1 to let the */
+/* emulator draw it.  The delay counts from when the packet is sent; the  */
+/* emulator only adds to it to keep the channel FIFO, when the packet     */
+/* would otherwise arrive before one sent earlier (unless -r lets it).    */
+/* Lines starting with # are ignored.                                     */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+
+int main(void)
+{
+  char line[256];
+  struct replayrec rec;
+  int drop, corrupt, lineno = 0;
+  float delay;
+  long n = 0;
+
+  fwrite(REPLAY_MAGIC, 1, strlen(REPLAY_MAGIC), stdout);
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    lineno++;
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+    if (sscanf(line, "%d %d %f", &drop, &corrupt, &delay) != 3
+        || corrupt < 0 || corrupt > REPLAY_CORRUPT_ACK) {
+      fprintf(stderr, "mkreplay: bad record on line %d\n", lineno);
+      return EXIT_FAILURE;
+    }
+    memset(&rec, 0, sizeof(rec));
+    rec.drop = drop != 0;
+    rec.corrupt = corrupt;
+    rec.delay = delay;
+    fwrite(&rec, sizeof(rec), 1, stdout);
+    n++;
+  }
+  fprintf(stderr, "mkreplay: %ld records\n", n);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,77 @@
+/* Opt-in instrumentation of the hot paths.  Build with -DPROFILE and each
+   instrumented function counts its calls and keeps a log2 histogram of
+   the time spent in it (TSC cycles on x86-64, nanoseconds elsewhere);
+   the emulator prints one line per function when it terminates.  Without
+   PROFILE every macro below expands to nothing, so the normal build is
+   unchanged.
+
+   Usage, PROF_DECL last among the declarations:
+       PROF_DECL(t);
+       PROF_START(t);  ...  PROF_STOP(PROF_CHECKSUM, t);
+   or around a single call:
+       PROF_CALL(PROF_A_INPUT, A_input(conn, packet));
+   Times are inclusive: A_input's contains the ComputeChecksum, stoptimer
+   and tolayer3 calls it makes. */
+#ifndef PROF_H
+#define PROF_H
+
+/* the instrumented functions */
+#define PROF_NEXTEVENT    0
+#define PROF_INSERTEVENT  1
+#define PROF_REMOVEEVENT  2
+#define PROF_STARTTIMER   3
+#define PROF_STOPTIMER    4
+#define PROF_TOLAYER3     5
+#define PROF_TOLAYER5     6
+#define PROF_CHECKSUM     7
+#define PROF_A_OUTPUT     8
+#define PROF_A_INPUT      9
+#define PROF_B_INPUT      10
+#define PROF_A_TIMER      11
+#define PROF_NFUNCS       12
+
+#ifdef PROFILE
+
+#define PROF_BUCKETS 48   /* bucket b counts times in [2^(b-1), 2^b) */
+
+struct profstat {
+  unsigned long calls;
+  unsigned long total;
+  unsigned long max;
+  unsigned long hist[PROF_BUCKETS];
+};
+
+extern struct profstat profstats[PROF_NFUNCS];
+extern void profrecord(int func, unsigned long ticks);
+extern unsigned long profclock(void);
+extern void profdump(void);
+
+#if defined(__x86_64__)
+#define PROF_UNIT "cycles"
+#define PROF_NOW(v) do { unsigned int lo_, hi_; \
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo_), "=d" (hi_)); \
+    (v) = ((unsigned long)hi_ << 32) | lo_; } while (0)
+#else
+#define PROF_UNIT "ns"
+#define PROF_NOW(v) ((v) = profclock())
+#endif
+
+#define PROF_DECL(v)        unsigned long v
+#define PROF_START(v)       PROF_NOW(v)
+#define PROF_STOP(func, v)  do { unsigned long end_; PROF_NOW(end_); \
+    profrecord((func), end_ - (v)); } while (0)
+#define PROF_CALL(func, call) do { unsigned long start_; PROF_NOW(start_); \
+    call; PROF_STOP((func), start_); } while (0)
+#define PROF_DUMP()         profdump()
+
+#else
+
+#define PROF_DECL(v)
+#define PROF_START(v)
+#define PROF_STOP(func, v)
+#define PROF_CALL(func, call) call
+#define PROF_DUMP()
+
+#endif
+
+#endif
@@ -0,0 +1,490 @@
+/* ******************************************************************
+   REAL-TIME THREADED BACKEND
+
+   Runs the A and B entities (sr.c or gbn.c) on two threads in wall
+   clock time instead of the discrete event emulator, so that contention
+   and cache effects between the two sides show up:
+
+     gcc -Wall -ansi -pedantic -O2 -pthread -o sr_rt realtime.c sr.c
+     ./sr_rt -N 1000000 -d 20 -j 10 -l 0.01 -c 0,1
+
+   - A and B each run a loop on their own thread and only ever call
+     their own entry points,
+   - a packet handed to tolayer3() goes into a lock-free single producer,
+     single consumer ring towards the other thread, stamped with the time
+     it may be taken out (-d delay plus up to -j jitter, never before the
+     packet ahead of it: the channel stays FIFO), or is dropped with
+     probability -l or when the ring is full,
+   - timers are deadlines on CLOCK_MONOTONIC checked by the owning thread,
+     one protocol time unit being -u microseconds.
+
+   A's thread keeps its window full until -N messages have been accepted;
+   each message carries the time it was handed to A_output(), so B can
+   record its latency when tolayer5() is called.  The run ends when B has
+   them all, and reports the sustained message rate and the latency
+   percentiles.
+**********************************************************************/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "emulator.h"
+#include "sr.h"
+
+#define CACHELINE 64
+
+int TRACE = 0;
+int mtu = MAXPAYLOAD;
+int msgsize = 20;
+int fec_k = 0;
+int retx_mode = RETX_SR;
+int window_size;
+int nak_holdoff;
+int flow_control;
+
+/* statistics updated by the protocol; the A_ ones are only touched by */
+/* A's thread and the B_ ones by B's thread                            */
+int window_full;
+int rcv_buffer_max;
+int total_ACKs_received;
+int packets_resent;
+int new_ACKs;
+int packets_received;
+int fec_recovered;
+int retx_recovered;
+int mode_switches;
+int unacked_packets;
+int buffered_packets;
+int naks_sent;
+int nak_resends;
+int timeout_resends;
+int flow_limited;
+int window_probes;
+
+/* run parameters */
+static int nsimmax = 100000;       /* messages to deliver, -N */
+static int nflows = 1;             /* connections, -n */
+static double lossprob;            /* probability a packet is dropped, -l */
+static double delay;               /* one way delay in seconds, -d */
+static double jitter;              /* extra random delay up to this, -j */
+static double unit = 100e-6;       /* seconds per protocol time unit, -u */
+static unsigned long ringsize = 4096; /* slots per direction, -q */
+static int cpus[2] = { -1, -1 };   /* cores for A and B, -c */
+static double maxseconds = 60.0;   /* give up after this long, -w */
+
+/* one packet in flight */
+struct slot {
+  int conn;
+  double due;                      /* earliest time it may be delivered */
+  struct pkt packet;
+};
+
+/* ring[A] carries A->B and ring[B] carries B->A.  head is only written */
+/* by the consumer and tail by the producer, each on its own cache line */
+struct ring {
+  unsigned long head;
+  char pad1[CACHELINE - sizeof(unsigned long)];
+  unsigned long tail;
+  double lastdue;                  /* producer only: keeps the ring FIFO */
+  char pad2[CACHELINE - sizeof(unsigned long) - sizeof(double)];
+  struct slot *slots;
+};
+
+static struct ring rings[2];
+
+/* per thread state, indexed by A or B */
+struct entity {
+  double now;                      /* wall clock at the top of the loop */
+  double *deadline;                /* per connection, < 0 when stopped */
+  double nextdeadline;             /* no timer fires before this */
+  unsigned long rand;              /* state of the loss/jitter generator */
+  unsigned long pktssent;          /* packets put in the ring */
+  unsigned long pktslost;          /* dropped by the loss probability */
+  unsigned long overflows;         /* dropped because the ring was full */
+  unsigned long idle;              /* loops that found nothing to do */
+  char pad[CACHELINE];
+};
+
+static struct entity ents[2];
+
+static double started;
+static int done;                   /* set once B has every message */
+static int nsim;                   /* messages accepted, A's thread only */
+static int refused;                /* offers refused by a full window */
+static int delivered;              /* B's thread only */
+static unsigned long bytes_delivered;
+static float *latencies;           /* one per delivered message, seconds */
+
+/* wall clock in seconds */
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* per thread uniform draw on [0,1) */
+static double draw(struct entity *ent)
+{
+  ent->rand ^= ent->rand << 13;
+  ent->rand ^= ent->rand >> 7;
+  ent->rand ^= ent->rand << 17;
+  return (ent->rand & 0xffffff) / (double)0x1000000;
+}
+
+/********************** routines called by the protocol *****************/
+
+void tolayer3(int AorB, int conn, struct pkt packet)
+{
+  struct entity *ent = &ents[AorB];
+  struct ring *r = &rings[AorB];
+  struct slot *s;
+  unsigned long tail = r->tail;
+  double due;
+
+  if (lossprob > 0.0 && draw(ent) < lossprob) {
+    ent->pktslost++;
+    return;
+  }
+  if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == ringsize) {
+    ent->overflows++;
+    return;
+  }
+  due = ent->now + delay;
+  if (jitter > 0.0)
+    due += jitter * draw(ent);
+  if (due < r->lastdue)
+    due = r->lastdue;
+  r->lastdue = due;
+
+  s = &r->slots[tail & (ringsize - 1)];
+  s->conn = conn;
+  s->due = due;
+  memcpy(&s->packet, &packet, PKT_USED(packet));
+  __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+  ent->pktssent++;
+}
+
+void tolayer5(int AorB, int conn, char *datasent, int length)
+{
+  double sent;
+
+  memcpy(&sent, datasent, sizeof(double));
+  latencies[delivered++] = (float)(now() - sent);
+  bytes_delivered += length;
+  if (delivered == nsimmax)
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+}
+
+/* layer 5 here reads everything as soon as it is delivered */
+int layer5_unread(int AorB, int conn)
+{
+  return 0;
+}
+
+void starttimer(int AorB, int conn, double increment)
+{
+  struct entity *ent = &ents[AorB];
+
+  if (ent->deadline[conn] >= 0.0) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  ent->deadline[conn] = ent->now + increment * unit;
+  if (ent->deadline[conn] < ent->nextdeadline)
+    ent->nextdeadline = ent->deadline[conn];
+}
+
+void stoptimer(int AorB, int conn)
+{
+  struct entity *ent = &ents[AorB];
+
+  if (ent->deadline[conn] < 0.0) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  /* nextdeadline is left alone: an early look at the timers is harmless */
+  ent->deadline[conn] = -1.0;
+}
+
+/****************************** the backend *****************************/
+
+static void usage(char *prog)
+{
+  printf("usage: %s [-N msgs] [-s msgsize] [-m mtu] [-n flows] [-F k] [-R mode]\n"
+         "       [-K holdoff] [-l lossprob] [-d usec] [-j usec] [-u usec] [-q slots]\n"
+         "       [-c cpuA,cpuB] [-w seconds] [-t trace]\n", prog);
+  printf("  -N msgs     messages to deliver (default 100000)\n");
+  printf("  -s msgsize  bytes per message, at least %d (default 20)\n", (int)sizeof(double));
+  printf("  -m mtu      payload bytes per packet (default %d)\n", MAXPAYLOAD);
+  printf("  -n flows    connections between A and B (default 1)\n");
+  printf("  -F k        one XOR parity packet per k data packets (sr.c only)\n");
+  printf("  -R mode     resend after a timeout: sr, gbn or adaptive (sr.c only)\n");
+  printf("  -K holdoff  B NAKs gaps, again after holdoff more packets (sr.c only)\n");
+  printf("  -l prob     probability that a packet is dropped (default 0)\n");
+  printf("  -d usec     one way delay of the rings (default 0)\n");
+  printf("  -j usec     uniform extra delay up to this (default 0)\n");
+  printf("  -u usec     microseconds per protocol time unit (default 100)\n");
+  printf("  -q slots    ring slots per direction, a power of 2 (default 4096)\n");
+  printf("  -c a,b      pin A's and B's threads to these cores\n");
+  printf("  -w seconds  give up after this long (default 60)\n");
+  printf("  -t trace    protocol TRACE level (default 0)\n");
+  exit(EXIT_FAILURE);
+}
+
+static void parseargs(int argc, char **argv)
+{
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (i + 1 >= argc)
+      usage(argv[0]);
+    if (strcmp(argv[i], "-N") == 0)
+      nsimmax = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0)
+      msgsize = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-m") == 0)
+      mtu = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-n") == 0)
+      nflows = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-F") == 0)
+      fec_k = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-K") == 0)
+      nak_holdoff = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-R") == 0) {
+      i++;
+      if (strcmp(argv[i], "sr") == 0)
+        retx_mode = RETX_SR;
+      else if (strcmp(argv[i], "gbn") == 0)
+        retx_mode = RETX_GBN;
+      else if (strcmp(argv[i], "adaptive") == 0)
+        retx_mode = RETX_ADAPTIVE;
+      else
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-l") == 0)
+      lossprob = atof(argv[++i]);
+    else if (strcmp(argv[i], "-d") == 0)
+      delay = atof(argv[++i]) / 1e6;
+    else if (strcmp(argv[i], "-j") == 0)
+      jitter = atof(argv[++i]) / 1e6;
+    else if (strcmp(argv[i], "-u") == 0)
+      unit = atof(argv[++i]) / 1e6;
+    else if (strcmp(argv[i], "-q") == 0)
+      ringsize = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "-c") == 0) {
+      if (sscanf(argv[++i], "%d,%d", &cpus[A], &cpus[B]) != 2)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-w") == 0)
+      maxseconds = atof(argv[++i]);
+    else if (strcmp(argv[i], "-t") == 0)
+      TRACE = atoi(argv[++i]);
+    else
+      usage(argv[0]);
+  }
+  if (nsimmax < 1 || msgsize < (int)sizeof(double) || msgsize > MAXMSG || mtu < 1
+      || mtu > MAXPAYLOAD || nflows < 1 || fec_k < 0 || nak_holdoff < 0 || lossprob < 0.0 || lossprob >= 1.0
+      || delay < 0.0 || jitter < 0.0 || unit <= 0.0
+      || ringsize < 2 || (ringsize & (ringsize - 1)) != 0)
+    usage(argv[0]);
+}
+
+/* A's thread: keep every connection's sender busy */
+static int feed(void)
+{
+  static struct msg message;
+  static int conn;
+  int tries, before, fed = 0;
+  double t;
+
+  for (tries = 0; tries < nflows && nsim < nsimmax; tries++) {
+    t = now();
+    message.length = msgsize;
+    memset(message.data, 'a' + nsim % 26, msgsize);
+    memcpy(message.data, &t, sizeof(double));
+    before = window_full;
+    A_output(conn, message);
+    if (window_full != before)
+      refused++;           /* offered again next time round */
+    else {
+      nsim++;
+      fed = 1;
+      tries = -1;          /* the same connection may take more */
+      continue;
+    }
+    conn = (conn + 1) % nflows;
+  }
+  return fed;
+}
+
+/* hand the entity e every packet in its incoming ring that is due */
+static int drain(int e)
+{
+  struct ring *r = &rings[1 - e];
+  struct slot *s;
+  unsigned long head = r->head, tail, first = head;
+
+  tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    s = &r->slots[head & (ringsize - 1)];
+    if (s->due > ents[e].now)
+      break;
+    if (e == A)
+      A_input(s->conn, s->packet);
+    else
+      B_input(s->conn, s->packet);
+    head++;
+  }
+  if (head != first)
+    __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+  return head != first;
+}
+
+/* fire the entity e's timers that have expired */
+static int expire(int e)
+{
+  struct entity *ent = &ents[e];
+  int conn, fired = 0;
+
+  if (ent->now < ent->nextdeadline)
+    return 0;
+  ent->nextdeadline = 1e300;
+  for (conn = 0; conn < nflows; conn++) {
+    if (ent->deadline[conn] >= 0.0 && ent->deadline[conn] <= ent->now) {
+      ent->deadline[conn] = -1.0;
+      fired = 1;
+      if (e == A)
+        A_timerinterrupt(conn);
+      else
+        B_timerinterrupt(conn);
+    }
+    if (ent->deadline[conn] >= 0.0 && ent->deadline[conn] < ent->nextdeadline)
+      ent->nextdeadline = ent->deadline[conn];
+  }
+  return fired;
+}
+
+static void *run(void *arg)
+{
+  int e = *(int *)arg, busy, stalled = 0;
+  struct entity *ent = &ents[e];
+
+  if (cpus[e] >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[e], &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      printf("warning: could not pin %c to core %d\n", "AB"[e], cpus[e]);
+  }
+  while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+    ent->now = now();
+    if (ent->now - started > maxseconds) {
+      __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+      break;
+    }
+    busy = drain(e);
+    busy |= expire(e);
+    /* a full window can only open up after an ACK or a timeout */
+    if (e == A && (busy || !stalled)) {
+      busy |= feed();
+      stalled = 1;
+    }
+    if (!busy) {
+      /* let the other side run when they share a core */
+      ent->idle++;
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+static int cmpfloat(const void *a, const void *b)
+{
+  float x = *(const float *)a, y = *(const float *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* latency below which the fraction p of the delivered messages fall, in us */
+static double percentile(double p)
+{
+  int i = (int)(p * delivered);
+
+  if (i >= delivered)
+    i = delivered - 1;
+  return latencies[i] * 1e6;
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t threads[2];
+  int ids[2] = { A, B };
+  int e, conn;
+  double elapsed;
+  unsigned long pkts;
+
+  parseargs(argc, argv);
+  latencies = malloc(nsimmax * sizeof(float));
+  for (e = A; e <= B; e++) {
+    rings[e].slots = malloc(ringsize * sizeof(struct slot));
+    ents[e].deadline = malloc(nflows * sizeof(double));
+    if (rings[e].slots == NULL || ents[e].deadline == NULL || latencies == NULL) {
+      printf("out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    for (conn = 0; conn < nflows; conn++)
+      ents[e].deadline[conn] = -1.0;
+    ents[e].nextdeadline = 1e300;
+    ents[e].rand = 9999 + e;
+  }
+  ents[A].now = ents[B].now = started = now();
+  A_init(nflows);
+  B_init(nflows);
+
+  for (e = A; e <= B; e++)
+    if (pthread_create(&threads[e], NULL, run, &ids[e]) != 0) {
+      printf("could not start a thread\n");
+      exit(EXIT_FAILURE);
+    }
+  for (e = A; e <= B; e++)
+    pthread_join(threads[e], NULL);
+  elapsed = now() - started;
+
+  if (delivered < nsimmax)
+    printf("giving up after %.0f seconds\n", maxseconds);
+  printf("Real-time run: %d connections, %d byte messages, mtu %d, loss %f, delay %.1f+%.1f us\n",
+         nflows, msgsize, mtu, lossprob, delay * 1e6, jitter * 1e6);
+  printf("number of messages delivered to application:  %d in %f seconds\n", delivered, elapsed);
+  printf("number of bytes delivered to application:  %lu \n", bytes_delivered);
+  printf("number of packets sent A->B:  %lu (lost %lu, ring full %lu)\n",
+         ents[A].pktssent, ents[A].pktslost, ents[A].overflows);
+  printf("number of packets sent B->A:  %lu (lost %lu, ring full %lu)\n",
+         ents[B].pktssent, ents[B].pktslost, ents[B].overflows);
+  printf("number of packet resends by A:  %d \n", packets_resent);
+  if (retx_mode == RETX_ADAPTIVE)
+    printf("number of switches between GBN and SR retransmission:  %d \n", mode_switches);
+  if (nak_holdoff > 0)
+    printf("number of packet resends by A after a NAK:  %d, after a timeout:  %d \n",
+           nak_resends, timeout_resends);
+  if (fec_k > 0) {
+    printf("number of packets recovered by FEC at B:  %d \n", fec_recovered);
+    printf("number of packets recovered by retransmission at B:  %d \n", retx_recovered);
+  }
+  printf("number of offers refused by a full window:  %d \n", refused);
+  printf("idle loops: A %lu, B %lu\n", ents[A].idle, ents[B].idle);
+  printf("messages per second:  %.0f \n", delivered / elapsed);
+  pkts = ents[A].pktssent + ents[B].pktssent;
+  printf("packets per second:  %.0f \n", pkts / elapsed);
+  if (delivered > 0) {
+    qsort(latencies, delivered, sizeof(float), cmpfloat);
+    printf("message latency (us):  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           percentile(0.50), percentile(0.90), percentile(0.99), percentile(0.999),
+           latencies[delivered - 1] * 1e6);
+  }
+  return delivered == nsimmax ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,390 +1,947 @@
-#include <stdlib.h>
-#include <stdio.h>
-#include <stdbool.h>
-#include "emulator.h"
-#include "sr.h"
-
-/* ******************************************************************
-   Selective Repeat protocol.  Adapted from J.F.Kurose Go-Back-N
-   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2  
-
-   Network properties:
-   - one way network delay averages five time units (longer if there
-   are other messages in the channel for GBN), but can be larger
-   - packets can be corrupted (either the header or the data portion)
-   or lost, according to user-defined probabilities
-   - packets will be delivered in the order in which they were sent
-   (although some can be lost).
-
-   Modifications: 
-   - removed bidirectional GBN code and other code not used by prac. 
-   - fixed C style to adhere to current programming style
-   - added Selective Repeat implementation
-**********************************************************************/
-
-#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE 7      /* the min sequence space for SR must be at least windowsize + 1 */
-#define NOTINUSE (-1)   /* used to fill header fields that are not being used */
-#define UNACKED (0)     /* packet has not been acknowledged */
-#define ACKED (1)       /* packet has been acknowledged */
-
-/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
-   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
-   original checksum.  This procedure must generate a different checksum to the original if
-   the packet is corrupted.
-*/
-int ComputeChecksum(struct pkt packet)
-{
-  int checksum = 0;
-  int i;
-
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ ) 
-    checksum += (int)(packet.payload[i]);
-
-  return checksum;
-}
-
-bool IsCorrupted(struct pkt packet)
-{
-  if (packet.checksum == ComputeChecksum(packet))
-    return (false);
-  else
-    return (true);
-}
-
-
-/********* Sender (A) variables and functions ************/
-
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
-
-/* SR specific variables for sender */
-static int ack_status[WINDOWSIZE];     /* track if packet is acknowledged */
-static int timer_active;               /* flag to track if timer is active */
-static int earliest_unacked;           /* track earliest unacked packet for timing */
-
-/* helper function to find the index for a sequence number */
-int find_buffer_index(int seqnum) {
-  int i;
-  for (i = 0; i < windowcount; i++) {
-    int buffer_index = (windowfirst + i) % WINDOWSIZE;
-    if (buffer[buffer_index].seqnum == seqnum) {
-      return buffer_index;
-    }
-  }
-  return -1;
-}
-
-/* helper function to find earliest unacked packet */
-void find_earliest_unacked(void) {
-  int i;
-  earliest_unacked = -1;
-  
-  for (i = 0; i < windowcount; i++) {
-    int buffer_index = (windowfirst + i) % WINDOWSIZE;
-    if (ack_status[buffer_index] == UNACKED) {
-      earliest_unacked = buffer_index;
-      break;
-    }
-  }
-}
-
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
-{
-  struct pkt sendpkt;
-  int i;
-
-  /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
-    if (TRACE > 1)
-      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
-
-    /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for ( i=0; i<20 ; i++ ) 
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt); 
-
-    /* put packet in window buffer */
-    windowlast = (windowlast + 1) % WINDOWSIZE; 
-    buffer[windowlast] = sendpkt;
-    windowcount++;
-    
-    /* mark packet as unacknowledged */
-    ack_status[windowlast] = UNACKED;
-
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
-
-    /* start timer if no timer is active */
-    if (!timer_active) {
-      starttimer(A, RTT);
-      timer_active = 1;
-      earliest_unacked = windowlast;
-    }
-
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
-  }
-  /* if blocked,  window is full */
-  else {
-    if (TRACE > 0)
-      printf("----A: New message arrives, send window is full\n");
-    window_full++;
-  }
-}
-
-
-/* called from layer 3, when a packet arrives for layer 4 
-   In this practical this will always be an ACK as B never sends data.
-*/
-void A_input(struct pkt packet)
-{
-  int found = 0;
-  int buffer_index;
-
-  /* if received ACK is not corrupted */ 
-  if (!IsCorrupted(packet)) {
-    if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
-    total_ACKs_received++;
-
-    /* find the packet being acknowledged */
-    buffer_index = find_buffer_index(packet.acknum);
-    
-    if (buffer_index != -1 && ack_status[buffer_index] == UNACKED) {
-      
-      found = 1;  /* Mark that we found the packet */
-      
-      /* mark packet as acknowledged */
-      ack_status[buffer_index] = ACKED;
-      new_ACKs++;
-      
-      if (TRACE > 0)
-        printf("----A: ACK %d is not a duplicate\n",packet.acknum);
-      
-      /* if this ACK is for the packet we're timing, need to find next */
-      if (buffer_index == earliest_unacked) {
-        stoptimer(A);
-        timer_active = 0;
-        
-        /* Find next unacked packet to time */
-        find_earliest_unacked();
-        
-        if (earliest_unacked != -1) {
-          starttimer(A, RTT);
-          timer_active = 1;
-        }
-      }
-        
-      /* if this is the first packet in window, slide window */
-      if (buffer_index == windowfirst) {
-        /* slide window for all consecutive acknowledged packets */
-        while (windowcount > 0 && ack_status[windowfirst] == ACKED) {
-          windowfirst = (windowfirst + 1) % WINDOWSIZE;
-          windowcount--;
-        }
-      }
-    }
-    
-    /* If we didn't find the packet or it was already acked, it's a duplicate ACK */
-    if (!found && TRACE > 0) {
-      printf("----A: duplicate ACK received, do nothing!\n");
-    }
-  }
-  else {
-    if (TRACE > 0)
-      printf ("----A: corrupted ACK is received, do nothing!\n");
-  }
-}
-
-/* called when A's timer goes off */
-void A_timerinterrupt(void)
-{
-  if (TRACE > 0)
-    printf("----A: time out,resend packets!\n");
-
-  /* find the packet that timed out and retransmit it */
-  if (earliest_unacked != -1 && ack_status[earliest_unacked] == UNACKED) {
-    
-    if (TRACE > 0)
-      printf ("---A: resending packet %d\n", buffer[earliest_unacked].seqnum);
-    
-    /* resend only the timed-out packet */
-    tolayer3(A, buffer[earliest_unacked]);
-    packets_resent++;
-    
-    /* restart timer for same packet */
-    starttimer(A, RTT);
-  } else {
-    /* find next earliest unacked */
-    find_earliest_unacked();
-    
-    if (earliest_unacked != -1) {
-      starttimer(A, RTT);
-    } else {
-      timer_active = 0;
-    }
-  }
-}       
-
-
-/* the following routine will be called once (only) before any other */
-/* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
-{
-  int i;
-  
-  /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.  
-		     new packets are placed in winlast + 1 
-		     so initially this is set to -1
-		   */
-  windowcount = 0;
-  
-  /* initialize SR specific variables */
-  for (i = 0; i < WINDOWSIZE; i++) {
-    ack_status[i] = UNACKED;
-  }
-  timer_active = 0;
-  earliest_unacked = -1;
-}
-
-
-/********* Receiver (B)  variables and procedures ************/
-
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
-
-
-/* SR specific variables for receiver */
-static struct pkt rcv_buffer[WINDOWSIZE];  /* buffer for out-of-order packets */
-static int buffer_status[WINDOWSIZE];      /* track if buffer position is occupied */
-static int rcv_base;                       /* base of receive window */
-
-void B_input(struct pkt packet)
-{
-  struct pkt sendpkt;
-  int i;
-  int rel_seqnum;
-  int buffer_index;
-  int in_window = 0;
-
-  /* if not corrupted */
-  if (!IsCorrupted(packet)) {
-    
-    /* Check if packet is within receive window */
-    rel_seqnum = packet.seqnum - rcv_base;
-    if (rel_seqnum < 0)
-      rel_seqnum += SEQSPACE;
-      
-    if (rel_seqnum < WINDOWSIZE) {
-      in_window = 1;
-    }
-    
-    if (in_window) {
-      /* Packet is within receive window */
-      packets_received++;  /* Count all correctly received packets */
-      
-      if (TRACE > 0)
-        printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
-      
-      buffer_index = rel_seqnum;
-      
-      /* Store packet if not already buffered (don't buffer duplicates) */
-      if (buffer_status[buffer_index] == 0) {
-        rcv_buffer[buffer_index] = packet;
-        buffer_status[buffer_index] = 1;
-      }
-      
-      /* If this is the expected packet, deliver it and consecutive buffered packets */
-      if (packet.seqnum == expectedseqnum) {
-        /* Deliver the expected packet */
-        tolayer5(B, packet.payload);
-        buffer_status[buffer_index] = 0;
-        expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
-        
-        /* Deliver consecutive buffered packets */
-        for (i = 0; i < WINDOWSIZE; i++) {
-          if (buffer_status[i] == 1) {
-            /* Found a consecutive buffered packet */
-            tolayer5(B, rcv_buffer[i].payload);
-            buffer_status[i] = 0;
-            expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
-          } else {
-            /* No more consecutive packets */
-            break;
-          }
-        }
-        
-        /* Update receive window base */
-        rcv_base = expectedseqnum;
-      }
-    }
-    else {
-      /* packet is outside window */
-      if (TRACE > 0)
-        printf("----B: packet %d is outside window, ignore\n", packet.seqnum);
-    }
-    
-    /* Send ACK for received packet */
-    sendpkt.acknum = packet.seqnum;
-  }
-  else {
-    /* do not send ACK for corrupted packet */
-    return;
-  }
-
-  /* create ACK packet */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
-    
-  /* we don't have any data to send. fill payload with 0's */
-  for (i = 0; i < 20; i++) 
-    sendpkt.payload[i] = '0';  
-
-  /* compute checksum */
-  sendpkt.checksum = ComputeChecksum(sendpkt); 
-
-  /* send out ACK packet */
-  tolayer3 (B, sendpkt);
-}
-
-void B_init(void)
-{
-  int i;
-  
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
-  
-  /* initialize SR specific variables */
-  rcv_base = 0;
-  for (i = 0; i < WINDOWSIZE; i++) {
-    buffer_status[i] = 0;
-  }
-}
-
-/******************************************************************************
- * The following functions need be completed only for bi-directional messages *
- *****************************************************************************/
-
-/* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)  
-{
-}
-
-/* called when B's timer goes off */
-void B_timerinterrupt(void)
-{
-}
\ No newline at end of file
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "emulator.h"
+#include "prof.h"
+#include "engine.h"
+#include "sr.h"
+
+/* ******************************************************************
+   Selective Repeat protocol.  Adapted from J.F.Kurose Go-Back-N
+   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2  
+
+   Network properties:
+   - one way network delay averages five time units (longer if there
+   are other messages in the channel for GBN), but can be larger
+   - packets can be corrupted (either the header or the data portion)
+   or lost, according to user-defined probabilities
+   - packets will be delivered in the order in which they were sent
+   (although some can be lost).
+
+   Modifications: 
+   - removed bidirectional GBN code and other code not used by prac. 
+   - fixed C style to adhere to current programming style
+   - added Selective Repeat implementation
+**********************************************************************/
+
+#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+#define UNACKED (0)     /* packet has not been acknowledged */
+#define ACKED (1)       /* packet has been acknowledged */
+
+/* The window is fixed when the protocol is compiled: WINDOWSIZE packets,
+   DEFAULTWINDOW unless built with -DWINDOWSIZE=n, and -W must then be n
+   or left out.  Built with -DRUNTIME_WINDOW it is window_size instead
+   (-W, up to MAXWINDOW), which is slower: every wrap around the window or
+   the sequence space tests the size and may divide, and every array is
+   MAXWINDOW long.  engines.c links several builds into one program and
+   picks one at startup. */
+#define DEFAULTWINDOW 6
+#define MAXWINDOW 64
+#ifdef RUNTIME_WINDOW
+#define WINDOWSIZE window_size
+#define WINDOWMAX MAXWINDOW
+#else
+#ifndef WINDOWSIZE
+#define WINDOWSIZE DEFAULTWINDOW   /* the maximum number of buffered unacked packet */
+#endif
+#define WINDOWMAX WINDOWSIZE
+#endif
+/* On a FIFO channel SR needs twice the window, or B can take an old copy
+   of a packet for a new one.  With -r an old copy can turn up after
+   packets sent later, up to MAXLIFETIME after it was sent, and an ACK B
+   sends for it up to MAXLIFETIME after that.  A's window can move on by
+   one window per round trip, which takes at least 2, so the sequence
+   space must hold MAXLIFETIME + 2 windows. */
+#define SEQSPACE (32 * WINDOWSIZE)
+#if MAXLIFETIME + 2 > 32
+#error "SEQSPACE is too small for the channel's MAXLIFETIME"
+#endif
+
+/* B keeps packet seq in slot seq % RCVSLOTS.  The window and the window
+   before it, whose packets FEC may still need, never share a slot. */
+#define RCVSLOTS (2 * WINDOWSIZE)
+#define SEQMAX (2 * WINDOWMAX)
+
+/* i % n for the non-negative i used here, a mask when n is a power of two */
+#define MODULO(i, n) (((n) & ((n) - 1)) == 0 ? (i) & ((n) - 1) : (i) % (n))
+
+/* -DPACKET_TIMERS gives every unacked packet a timer of its own, the
+   named timer (starttimer_id) whose id is its window slot, instead of the
+   one timer that follows the earliest unacked packet.  A packet's timeout
+   starts at RTT and doubles each time it goes off, up to MAXBACKOFF*RTT:
+   otherwise, once the channel queues more than an RTT's worth, every
+   packet in the window is resent each RTT and the queue only grows.
+   Only emulator.c has named timers. */
+#define MAXBACKOFF 64
+
+/* -DNTRACE builds a protocol that never traces: every TRACE test below is
+   then constant and compiled away */
+#ifdef NTRACE
+#define TRACE 0
+#endif
+
+/* adaptive retransmission (-R adaptive): the sender keeps a moving average
+   of how often a packet needed a timeout or got a corrupted ACK back, and
+   resends GBN style (every unacked packet) while it is below LOSS_HIGH, SR
+   style (only the one that timed out) until it falls under LOSS_LOW again */
+#define LOSS_GAIN  0.03125
+#define LOSS_LOW   0.05
+#define LOSS_HIGH  0.15
+
+/* A parity packet (-F k) carries the XOR of the k data packets from its
+   seqnum on: its payload is the XOR of their payloads (zero padded to the
+   longest), PKT_EOM the XOR of their EOM flags, and acknum the XOR of
+   FEC_WORD() of each, so B can get back the length of a missing packet
+   and check the rebuilt packet against its original checksum. */
+#define FEC_WORD(length, checksum) \
+  ((int)((((unsigned)(checksum) & 0xffffu) << 16) | ((unsigned)(length) & 0xffffu)))
+
+/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
+   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
+   original checksum.  This procedure must generate a different checksum to the original if
+   the packet is corrupted.
+*/
+int ComputeChecksum(struct pkt packet)
+{
+  int checksum = 0;
+  int i;
+  PROF_DECL(t);
+
+  PROF_START(t);
+  checksum = packet.seqnum;
+  checksum += packet.acknum;
+  checksum += packet.length;
+  checksum += packet.flags;
+  for ( i=0; i<packet.length; i++ ) 
+    checksum += (int)(packet.payload[i]);
+
+  PROF_STOP(PROF_CHECKSUM, t);
+  return checksum;
+}
+
+bool IsCorrupted(struct pkt packet)
+{
+  if (packet.length < 0 || packet.length > MAXPAYLOAD)
+    return (true);
+  if (packet.checksum == ComputeChecksum(packet))
+    return (false);
+  else
+    return (true);
+}
+
+
+/********* Sender (A) variables and functions ************/
+
+/* sender state of one connection */
+struct sender {
+  struct pkt buffer[WINDOWMAX];    /* array for storing packets waiting for ACK */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int A_nextseqnum;               /* the next sequence number to be used by the sender */
+
+  /* SR specific variables for sender */
+  int ack_status[WINDOWMAX];      /* track if packet is acknowledged */
+  int timer_active;               /* flag to track if timer is active */
+  int earliest_unacked;           /* track earliest unacked packet for timing */
+
+  /* FEC: parity of the new packets sent since the last parity packet */
+  struct pkt parity;
+  int fec_count;
+
+  /* retransmission strategy */
+  int gbn_style;                  /* resend every unacked packet on a timeout */
+  double loss_est;                /* moving average of timeouts and bad ACKs */
+
+  /* flow control: packets B last said it has room for, from windowfirst on */
+  int peer_window;
+
+#ifdef PACKET_TIMERS
+  double timeout[WINDOWMAX];      /* each slot's timeout, see MAXBACKOFF */
+#endif
+};
+
+static struct sender *senders;         /* one per connection */
+static int nsenders;
+
+/* helper function to find the index for a sequence number */
+int find_buffer_index(struct sender *snd, int seqnum) {
+  int i;
+  for (i = 0; i < snd->windowcount; i++) {
+    int buffer_index = MODULO(snd->windowfirst + i, WINDOWSIZE);
+    if (snd->buffer[buffer_index].seqnum == seqnum) {
+      return buffer_index;
+    }
+  }
+  return -1;
+}
+
+/* helper function to find earliest unacked packet */
+void find_earliest_unacked(struct sender *snd) {
+  int i;
+  snd->earliest_unacked = -1;
+  
+  for (i = 0; i < snd->windowcount; i++) {
+    int buffer_index = MODULO(snd->windowfirst + i, WINDOWSIZE);
+    if (snd->ack_status[buffer_index] == UNACKED) {
+      snd->earliest_unacked = buffer_index;
+      break;
+    }
+  }
+}
+
+/* feed one outcome into the loss estimate (1: a timeout or a corrupted
+   ACK, 0: a new ACK) and change strategy when it crosses a threshold */
+void observe(struct sender *snd, int conn, int lost)
+{
+  snd->loss_est += LOSS_GAIN * (lost - snd->loss_est);
+  if (snd->gbn_style ? snd->loss_est > LOSS_HIGH : snd->loss_est < LOSS_LOW) {
+    snd->gbn_style = !snd->gbn_style;
+    mode_switches++;
+    if (TRACE > 0)
+      printf("----A: connection %d loss estimate %f, resending %s style\n", conn,
+             snd->loss_est, snd->gbn_style ? "GBN" : "SR");
+  }
+}
+
+/* resend the packet in window slot i, marked so that B can tell */
+void resend(struct sender *snd, int conn, int i)
+{
+  if (TRACE > 0)
+    printf ("---A: resending packet %d\n", snd->buffer[i].seqnum);
+  if (!(snd->buffer[i].flags & PKT_RETX)) {
+    snd->buffer[i].flags |= PKT_RETX;
+    snd->buffer[i].checksum = ComputeChecksum(snd->buffer[i]);
+  }
+  tolayer3(A, conn, snd->buffer[i]);
+  packets_resent++;
+}
+
+#ifdef PACKET_TIMERS
+/* the packet in slot i was resent after a timeout: wait twice as long */
+void backoff(struct sender *snd, int conn, int i)
+{
+  if (snd->timeout[i] < MAXBACKOFF * RTT)
+    snd->timeout[i] *= 2;
+  starttimer_id(A, conn, i, snd->timeout[i]);
+}
+#endif
+
+/* B's window is too small for anything to be sent, and with nothing
+   unacked no ACK will bring a new one: ask for it */
+void probe_window(struct sender *snd, int conn)
+{
+  struct pkt packet;
+
+  if (TRACE > 0)
+    printf("----A: B has room for %d packets, probing its window\n", snd->peer_window);
+  packet.seqnum = NOTINUSE;
+  packet.acknum = NOTINUSE;
+  packet.length = 0;
+  packet.flags = PKT_PROBE;
+  packet.checksum = ComputeChecksum(packet);
+  tolayer3(A, conn, packet);
+  window_probes++;
+}
+
+/* B named a packet in a NAK by the low byte of its seqnum, which is
+   enough to tell the packets in the window apart: resend it now rather
+   than when the timer goes off */
+void nak_resend(struct sender *snd, int conn, int seqbyte)
+{
+  int i, j;
+
+  for (j = 0, i = -1; j < snd->windowcount; j++) {
+    i = MODULO(snd->windowfirst + j, WINDOWSIZE);
+    if ((snd->buffer[i].seqnum & 0xff) == seqbyte)
+      break;
+  }
+  if (j == snd->windowcount || snd->ack_status[i] == ACKED)
+    return;
+  if (TRACE > 0)
+    printf("----A: NAK for packet %d\n", snd->buffer[i].seqnum);
+  resend(snd, conn, i);
+  nak_resends++;
+  /* give the copy just sent a whole RTT before the timer resends it again */
+#ifdef PACKET_TIMERS
+  stoptimer_id(A, conn, i);
+  starttimer_id(A, conn, i, snd->timeout[i]);
+#else
+  if (i == snd->earliest_unacked && snd->timer_active) {
+    stoptimer(A, conn);
+    starttimer(A, conn, RTT);
+  }
+#endif
+}
+
+/* fold a newly sent packet into the parity, sending it once the group is complete */
+void fec_add(struct sender *snd, int conn, struct pkt *packet)
+{
+  int i;
+
+  if (snd->fec_count == 0) {
+    snd->parity.seqnum = packet->seqnum;
+    snd->parity.acknum = 0;
+    snd->parity.flags = PKT_PARITY;
+    snd->parity.length = 0;
+  }
+  if (packet->length > snd->parity.length) {
+    memset(snd->parity.payload + snd->parity.length, 0, packet->length - snd->parity.length);
+    snd->parity.length = packet->length;
+  }
+  for (i = 0; i < packet->length; i++)
+    snd->parity.payload[i] ^= packet->payload[i];
+  snd->parity.flags ^= packet->flags & PKT_EOM;
+  snd->parity.acknum ^= FEC_WORD(packet->length, packet->checksum);
+
+  if (++snd->fec_count == fec_k) {
+    snd->parity.checksum = ComputeChecksum(snd->parity);
+    if (TRACE > 0)
+      printf("Sending parity for packets %d to %d to layer 3\n", snd->parity.seqnum,
+             MODULO(snd->parity.seqnum + fec_k - 1, SEQSPACE));
+    tolayer3(A, conn, snd->parity);
+    snd->fec_count = 0;
+  }
+}
+
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+void A_output(int conn, struct msg message)
+{
+  struct sender *snd = &senders[conn];
+  struct pkt *sendpkt;
+  int nsegs, offset, seg;
+
+  /* a message bigger than the MTU goes out as several segments, each of
+     which needs its own slot in the window */
+  nsegs = (message.length + mtu - 1) / mtu;
+  if (nsegs < 1)
+    nsegs = 1;
+
+  /* if not blocked waiting on ACK, and B has room for it */
+  if ( snd->windowcount + nsegs <= WINDOWSIZE && snd->windowcount + nsegs <= snd->peer_window) {
+    if (TRACE > 1)
+      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
+
+    for (seg = 0, offset = 0; seg < nsegs; seg++, offset += mtu) {
+      /* create packet directly in the window buffer */
+      snd->windowlast = MODULO(snd->windowlast + 1, WINDOWSIZE); 
+      sendpkt = &snd->buffer[snd->windowlast];
+      sendpkt->seqnum = snd->A_nextseqnum;
+      sendpkt->acknum = NOTINUSE;
+      sendpkt->length = message.length - offset < mtu ? message.length - offset : mtu;
+      sendpkt->flags = (seg == nsegs - 1) ? PKT_EOM : 0;
+      memcpy(sendpkt->payload, message.data + offset, sendpkt->length);
+      sendpkt->checksum = ComputeChecksum(*sendpkt); 
+      snd->windowcount++;
+      unacked_packets++;
+    
+      /* mark packet as unacknowledged */
+      snd->ack_status[snd->windowlast] = UNACKED;
+
+      /* send out packet */
+      if (TRACE > 0)
+        printf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+      tolayer3(A, conn, *sendpkt);
+      if (fec_k > 0)
+        fec_add(snd, conn, sendpkt);
+
+      /* the timer may be running only to probe B's window */
+      if (snd->timer_active && snd->earliest_unacked == -1) {
+        stoptimer(A, conn);
+        snd->timer_active = 0;
+      }
+
+#ifdef PACKET_TIMERS
+      snd->timeout[snd->windowlast] = RTT;
+      starttimer_id(A, conn, snd->windowlast, RTT);
+#else
+      /* start timer if no timer is active */
+      if (!snd->timer_active) {
+        starttimer(A, conn, RTT);
+        snd->timer_active = 1;
+        snd->earliest_unacked = snd->windowlast;
+      }
+#endif
+
+      /* get next sequence number, wrap back to 0 */
+      snd->A_nextseqnum = MODULO(snd->A_nextseqnum + 1, SEQSPACE);  
+    }
+  }
+  /* if blocked,  window is full */
+  else {
+    if (TRACE > 0)
+      printf("----A: New message arrives, send window is full\n");
+    window_full++;
+    if (snd->windowcount + nsegs <= WINDOWSIZE) {
+      flow_limited++;
+      /* with nothing unacked, only a probe will bring a new window */
+      if (snd->windowcount == 0 && !snd->timer_active) {
+        starttimer(A, conn, RTT);
+        snd->timer_active = 1;
+      }
+    }
+  }
+}
+
+
+/* called from layer 3, when a packet arrives for layer 4 
+   In this practical this will always be an ACK as B never sends data.
+*/
+void A_input(int conn, struct pkt packet)
+{
+  struct sender *snd = &senders[conn];
+  int found = 0;
+  int buffer_index, i;
+
+  /* if received ACK is not corrupted */ 
+  if (!IsCorrupted(packet)) {
+    if (flow_control) {
+      snd->peer_window = PKT_WINDOW(packet);
+      /* a window update, acknowledging nothing */
+      if (packet.acknum == NOTINUSE) {
+        if (TRACE > 0)
+          printf("----A: B has room for %d packets\n", snd->peer_window);
+        return;
+      }
+    }
+    if (TRACE > 0)
+      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
+    total_ACKs_received++;
+
+    /* find the packet being acknowledged */
+    buffer_index = find_buffer_index(snd, packet.acknum);
+    
+    if (buffer_index != -1 && snd->ack_status[buffer_index] == UNACKED) {
+      
+      found = 1;  /* Mark that we found the packet */
+      
+      /* mark packet as acknowledged */
+      snd->ack_status[buffer_index] = ACKED;
+      new_ACKs++;
+      if (retx_mode == RETX_ADAPTIVE)
+        observe(snd, conn, 0);
+      
+      if (TRACE > 0)
+        printf("----A: ACK %d is not a duplicate\n",packet.acknum);
+      
+#ifdef PACKET_TIMERS
+      stoptimer_id(A, conn, buffer_index);
+#else
+      /* if this ACK is for the packet we're timing, need to find next */
+      if (buffer_index == snd->earliest_unacked) {
+        stoptimer(A, conn);
+        snd->timer_active = 0;
+        
+        /* Find next unacked packet to time */
+        find_earliest_unacked(snd);
+        
+        if (snd->earliest_unacked != -1) {
+          starttimer(A, conn, RTT);
+          snd->timer_active = 1;
+        }
+      }
+#endif
+        
+      /* if this is the first packet in window, slide window */
+      if (buffer_index == snd->windowfirst) {
+        /* slide window for all consecutive acknowledged packets */
+        while (snd->windowcount > 0 && snd->ack_status[snd->windowfirst] == ACKED) {
+          snd->windowfirst = MODULO(snd->windowfirst + 1, WINDOWSIZE);
+          snd->windowcount--;
+          unacked_packets--;
+        }
+      }
+    }
+    
+    /* If we didn't find the packet or it was already acked, it's a duplicate ACK */
+    if (!found && TRACE > 0) {
+      printf("----A: duplicate ACK received, do nothing!\n");
+    }
+
+    /* the ACK may also name packets B is missing */
+    if (packet.flags & PKT_NAK)
+      for (i = 0; i < packet.length; i++)
+        nak_resend(snd, conn, (unsigned char)packet.payload[i]);
+  }
+  else {
+    if (TRACE > 0)
+      printf ("----A: corrupted ACK is received, do nothing!\n");
+    if (retx_mode == RETX_ADAPTIVE)
+      observe(snd, conn, 1);
+  }
+}
+
+/* called when A's timer goes off */
+void A_timerinterrupt(int conn)
+{
+  struct sender *snd = &senders[conn];
+  int i, buffer_index;
+
+  /* nothing is unacked: this is the timer that probes a closed window */
+  if (flow_control && snd->windowcount == 0) {
+    if (snd->peer_window < WINDOWSIZE) {
+      probe_window(snd, conn);
+      starttimer(A, conn, RTT);
+    }
+    else
+      snd->timer_active = 0;
+    return;
+  }
+
+  if (TRACE > 0)
+    printf("----A: time out,resend packets!\n");
+  if (retx_mode == RETX_ADAPTIVE)
+    observe(snd, conn, 1);
+
+#ifdef PACKET_TIMERS
+  /* the packet in slot timer_fired timed out; its timer is no longer running */
+  if (snd->gbn_style) {
+    for (i = 0; i < snd->windowcount; i++) {
+      buffer_index = MODULO(snd->windowfirst + i, WINDOWSIZE);
+      if (snd->ack_status[buffer_index] == UNACKED) {
+        resend(snd, conn, buffer_index);
+        timeout_resends++;
+        if (buffer_index != timer_fired)
+          stoptimer_id(A, conn, buffer_index);
+        backoff(snd, conn, buffer_index);
+      }
+    }
+  }
+  else {
+    resend(snd, conn, timer_fired);
+    timeout_resends++;
+    backoff(snd, conn, timer_fired);
+  }
+#else
+  /* find the packet that timed out and retransmit it */
+  if (snd->earliest_unacked != -1 && snd->ack_status[snd->earliest_unacked] == UNACKED) {
+    
+    if (snd->gbn_style) {
+      /* go back: resend it and every unacked packet sent after it */
+      for (i = 0; i < snd->windowcount; i++) {
+        buffer_index = MODULO(snd->windowfirst + i, WINDOWSIZE);
+        if (snd->ack_status[buffer_index] == UNACKED) {
+          resend(snd, conn, buffer_index);
+          timeout_resends++;
+        }
+      }
+    }
+    else {
+      /* resend only the timed-out packet */
+      resend(snd, conn, snd->earliest_unacked);
+      timeout_resends++;
+    }
+    
+    /* restart timer for same packet */
+    starttimer(A, conn, RTT);
+  } else {
+    /* find next earliest unacked */
+    find_earliest_unacked(snd);
+    
+    if (snd->earliest_unacked != -1) {
+      starttimer(A, conn, RTT);
+    } else {
+      snd->timer_active = 0;
+    }
+  }
+#endif
+}       
+
+
+/* the following routine will be called once (only) before any other */
+/* entity A routines are called. You can use it to do any initialization */
+void A_init(int nconns)
+{
+  struct sender *snd;
+  int i, conn;
+
+#ifdef RUNTIME_WINDOW
+  if (window_size == 0)
+    window_size = DEFAULTWINDOW;
+  if (window_size < 1 || window_size > MAXWINDOW) {
+    printf("A_init: the window must be 1 to %d packets\n", MAXWINDOW);
+    exit(EXIT_FAILURE);
+  }
+#else
+  if (window_size != 0 && window_size != WINDOWSIZE) {
+    printf("A_init: built for a window of %d packets, build with -DWINDOWSIZE=%d\n",
+           WINDOWSIZE, window_size);
+    exit(EXIT_FAILURE);
+  }
+#endif
+  if ((msgsize + mtu - 1) / mtu > WINDOWSIZE) {
+    printf("A_init: a %d byte message takes %d packets of %d bytes, more than the window of %d\n",
+           msgsize, (msgsize + mtu - 1) / mtu, mtu, WINDOWSIZE);
+    exit(EXIT_FAILURE);
+  }
+  if (fec_k > WINDOWSIZE) {
+    printf("A_init: an FEC group can be at most %d packets\n", WINDOWSIZE);
+    exit(EXIT_FAILURE);
+  }
+  senders = calloc(nconns, sizeof(struct sender));
+  if (senders == NULL) {
+    printf("A_init: no memory for %d connections\n", nconns);
+    exit(EXIT_FAILURE);
+  }
+  nsenders = nconns;
+  for (conn = 0; conn < nconns; conn++) {
+    snd = &senders[conn];
+  
+    /* initialise A's window, buffer and sequence number */
+    snd->A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+    snd->windowfirst = 0;
+    snd->windowlast = -1;   /* windowlast is where the last packet sent is stored.  
+  		     new packets are placed in winlast + 1 
+  		     so initially this is set to -1
+  		   */
+    snd->windowcount = 0;
+  
+    /* initialize SR specific variables */
+    for (i = 0; i < WINDOWSIZE; i++) {
+      snd->ack_status[i] = UNACKED;
+    }
+    snd->timer_active = 0;
+    snd->earliest_unacked = -1;
+    snd->fec_count = 0;
+    snd->gbn_style = (retx_mode != RETX_SR);
+    snd->loss_est = 0.0;
+    snd->peer_window = WINDOWSIZE;
+  }
+}
+
+
+/********* Receiver (B)  variables and procedures ************/
+
+/* receiver state of one connection */
+struct receiver {
+  int expectedseqnum; /* the sequence number expected next by the receiver */
+  int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+
+  /* SR specific variables for receiver */
+  struct pkt rcv_buffer[SEQMAX];      /* buffer for out-of-order packets, by slot;
+                                         with FEC delivered ones are kept until reused */
+  int buffer_status[SEQMAX];          /* track if buffer position is occupied */
+  int buffered;                       /* number of packets held in rcv_buffer */
+  int rcv_base;                       /* base of receive window */
+
+  /* reassembly of messages that were split into several segments */
+  char reassembly[MAXMSG];            /* segments received so far */
+  int reassembled;                    /* number of bytes in reassembly */
+
+  /* NAKs (-K): nak_at[slot] is the value of received when its seqnum was last NAKed,
+     0 if it has not been since it went missing */
+  int received;                       /* in-window packets received so far */
+  int nak_at[SEQMAX];
+};
+
+static struct receiver *receivers;     /* one per connection */
+static int nreceivers;
+
+/* hand an in-order segment up, layer 5 only ever sees whole messages */
+void deliver_segment(int conn, struct pkt *packet)
+{
+  struct receiver *rcv = &receivers[conn];
+
+  /* common case: a message that fitted in one packet */
+  if (rcv->reassembled == 0 && (packet->flags & PKT_EOM)) {
+    tolayer5(B, conn, packet->payload, packet->length);
+    return;
+  }
+
+  if (rcv->reassembled + packet->length > MAXMSG) {
+    if (TRACE > 0)
+      printf("----B: reassembled message too long, discarding\n");
+    rcv->reassembled = 0;
+    return;
+  }
+  memcpy(rcv->reassembly + rcv->reassembled, packet->payload, packet->length);
+  rcv->reassembled += packet->length;
+  if (packet->flags & PKT_EOM) {
+    tolayer5(B, conn, rcv->reassembly, rcv->reassembled);
+    rcv->reassembled = 0;
+  }
+}
+
+/* A parity packet arrived.  If exactly one packet of its group is still
+   missing, and the others have been received, rebuild the missing one and
+   handle it as if it had arrived.  Packets behind the window have been
+   delivered and their copies are still in rcv_buffer. */
+void fec_rebuild(int conn, struct pkt *parity)
+{
+  struct receiver *rcv = &receivers[conn];
+  struct pkt rebuilt;
+  struct pkt *member;
+  int i, j, seq, missing = -1, word;
+
+  for (i = 0; i < fec_k; i++) {
+    seq = MODULO(parity->seqnum + i, SEQSPACE);
+    if (MODULO(seq - rcv->rcv_base + SEQSPACE, SEQSPACE) < WINDOWSIZE
+        && !rcv->buffer_status[MODULO(seq, RCVSLOTS)]) {
+      if (missing != -1)
+        return;             /* more than one gap: leave it to retransmissions */
+      missing = seq;
+    }
+  }
+  if (missing == -1)
+    return;
+
+  word = parity->acknum;
+  rebuilt.flags = parity->flags & PKT_EOM;
+  memcpy(rebuilt.payload, parity->payload, parity->length);
+  for (i = 0; i < fec_k; i++) {
+    seq = MODULO(parity->seqnum + i, SEQSPACE);
+    if (seq == missing)
+      continue;
+    member = &rcv->rcv_buffer[MODULO(seq, RCVSLOTS)];
+    /* a resent copy has PKT_RETX added to its flags, and so to its checksum */
+    word ^= FEC_WORD(member->length, member->checksum - (member->flags & PKT_RETX));
+    rebuilt.flags ^= member->flags & PKT_EOM;
+    for (j = 0; j < member->length && j < parity->length; j++)
+      rebuilt.payload[j] ^= member->payload[j];
+  }
+  rebuilt.seqnum = missing;
+  rebuilt.acknum = NOTINUSE;
+  rebuilt.length = word & 0xffff;
+  if (rebuilt.length > parity->length)
+    return;
+  rebuilt.checksum = ComputeChecksum(rebuilt);
+  if (FEC_WORD(rebuilt.length, rebuilt.checksum) != word)
+    return;                 /* the copies were not from this group */
+
+  if (TRACE > 0)
+    printf("----B: packet %d rebuilt from parity\n", missing);
+  fec_recovered++;
+  B_input(conn, rebuilt);
+}
+
+/* packets B has room for from rcv_base on: its window, less what its
+   application has not read yet */
+int rcv_room(int conn)
+{
+  int unread;
+
+  if (!flow_control)
+    return WINDOWSIZE;
+  unread = (layer5_unread(B, conn) + mtu - 1) / mtu;
+  return unread < WINDOWSIZE ? WINDOWSIZE - unread : 0;
+}
+
+/* an ACK that acknowledges nothing and only tells A the window */
+void send_window(int conn)
+{
+  struct receiver *rcv = &receivers[conn];
+  struct pkt sendpkt;
+
+  sendpkt.seqnum = rcv->B_nextseqnum;
+  rcv->B_nextseqnum = (rcv->B_nextseqnum + 1) % 2;
+  sendpkt.acknum = NOTINUSE;
+  sendpkt.length = 0;
+  sendpkt.flags = rcv_room(conn) << PKT_WINDOW_SHIFT;
+  sendpkt.checksum = ComputeChecksum(sendpkt);
+  tolayer3(B, conn, sendpkt);
+}
+
+/* List in ack the packets missing below the out-of-order packet seqnum:
+   those from expectedseqnum on that are not buffered, unless they were
+   NAKed fewer than nak_holdoff received packets ago.  Returns how many. */
+int nak_gaps(struct receiver *rcv, struct pkt *ack, int seqnum)
+{
+  int seq, slot, n = 0;
+
+  for (seq = rcv->expectedseqnum; seq != seqnum; seq = MODULO(seq + 1, SEQSPACE)) {
+    slot = MODULO(seq, RCVSLOTS);
+    if (!rcv->buffer_status[slot]
+        && (rcv->nak_at[slot] == 0 || rcv->received - rcv->nak_at[slot] >= nak_holdoff)) {
+      ack->payload[n++] = (char)seq;   /* its low byte, see nak_resend() */
+      rcv->nak_at[slot] = rcv->received;
+    }
+  }
+  return n;
+}
+
+void B_input(int conn, struct pkt packet)
+{
+  struct receiver *rcv = &receivers[conn];
+  struct pkt sendpkt;
+  int rel_seqnum, slot;
+  int in_window = 0;
+  int naks = 0;
+
+  /* if not corrupted */
+  if (!IsCorrupted(packet)) {
+
+    /* A wants to know the window */
+    if (packet.flags & PKT_PROBE) {
+      send_window(conn);
+      return;
+    }
+
+    /* parity packets are not acknowledged, they only stand in for a lost packet */
+    if (packet.flags & PKT_PARITY) {
+      if (fec_k > 0)
+        fec_rebuild(conn, &packet);
+      return;
+    }
+    
+    /* Check if packet is within receive window */
+    rel_seqnum = packet.seqnum - rcv->rcv_base;
+    if (rel_seqnum < 0)
+      rel_seqnum += SEQSPACE;
+      
+    if (rel_seqnum < WINDOWSIZE) {
+      in_window = 1;
+    }
+    slot = MODULO(packet.seqnum, RCVSLOTS);
+
+    /* no room for it until the application reads more: drop it, and tell A */
+    if (in_window && flow_control && !rcv->buffer_status[slot]
+        && rel_seqnum >= rcv_room(conn)) {
+      if (TRACE > 0)
+        printf("----B: no room for packet %d, send the window\n", packet.seqnum);
+      send_window(conn);
+      return;
+    }
+    
+    if (in_window) {
+      /* Packet is within receive window */
+      packets_received++;  /* Count all correctly received packets */
+      rcv->received++;
+      
+      if (TRACE > 0)
+        printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
+      
+      /* If this is the expected packet, deliver it and consecutive buffered packets */
+      if (packet.seqnum == rcv->expectedseqnum) {
+        if (packet.flags & PKT_RETX)
+          retx_recovered++;
+        if (fec_k > 0)
+          memcpy(&rcv->rcv_buffer[slot], &packet, PKT_USED(packet));
+
+        /* Deliver the expected packet */
+        deliver_segment(conn, &packet);
+        rcv->nak_at[slot] = 0;
+        rcv->expectedseqnum = MODULO(rcv->expectedseqnum + 1, SEQSPACE);
+        
+        /* Deliver consecutive buffered packets */
+        while (rcv->buffer_status[slot = MODULO(rcv->expectedseqnum, RCVSLOTS)] == 1) {
+          deliver_segment(conn, &rcv->rcv_buffer[slot]);
+          rcv->buffer_status[slot] = 0;
+          rcv->nak_at[slot] = 0;
+          rcv->buffered--;
+          buffered_packets--;
+          rcv->expectedseqnum = MODULO(rcv->expectedseqnum + 1, SEQSPACE);
+        }
+        
+        /* Update receive window base */
+        rcv->rcv_base = rcv->expectedseqnum;
+      }
+      /* Store out-of-order packet if not already buffered (don't buffer duplicates) */
+      else if (rcv->buffer_status[slot] == 0) {
+        if (packet.flags & PKT_RETX)
+          retx_recovered++;
+        memcpy(&rcv->rcv_buffer[slot], &packet, PKT_USED(packet));
+        rcv->buffer_status[slot] = 1;
+        rcv->buffered++;
+        buffered_packets++;
+        if (rcv->buffered > rcv_buffer_max)
+          rcv_buffer_max = rcv->buffered;
+      }
+
+      /* a packet above a gap: tell A what is missing */
+      if (rel_seqnum > 0 && nak_holdoff > 0) {
+        naks = nak_gaps(rcv, &sendpkt, packet.seqnum);
+        naks_sent += naks;
+        if (naks > 0 && TRACE > 0)
+          printf("----B: NAK for %d missing packets below %d\n", naks, packet.seqnum);
+      }
+    }
+    else {
+      /* packet is outside window */
+      if (TRACE > 0)
+        printf("----B: packet %d is outside window, ignore\n", packet.seqnum);
+    }
+    
+    /* Send ACK for received packet */
+    sendpkt.acknum = packet.seqnum;
+  }
+  else {
+    /* do not send ACK for corrupted packet */
+    return;
+  }
+
+  /* create ACK packet */
+  sendpkt.seqnum = rcv->B_nextseqnum;
+  rcv->B_nextseqnum = (rcv->B_nextseqnum + 1) % 2;
+    
+  /* we don't have any data to send, so the ACK carries no payload
+     except the list of missing packets, if there is one */
+  sendpkt.length = naks;
+  sendpkt.flags = naks > 0 ? PKT_NAK : 0;
+  if (flow_control)
+    sendpkt.flags |= rcv_room(conn) << PKT_WINDOW_SHIFT;
+
+  /* compute checksum */
+  sendpkt.checksum = ComputeChecksum(sendpkt); 
+
+  /* send out ACK packet */
+  tolayer3(B, conn, sendpkt);
+}
+
+void B_init(int nconns)
+{
+  struct receiver *rcv;
+  int i, conn;
+
+  receivers = calloc(nconns, sizeof(struct receiver));
+  if (receivers == NULL) {
+    printf("B_init: no memory for %d connections\n", nconns);
+    exit(EXIT_FAILURE);
+  }
+  nreceivers = nconns;
+  for (conn = 0; conn < nconns; conn++) {
+    rcv = &receivers[conn];
+  
+    rcv->expectedseqnum = 0;
+    rcv->B_nextseqnum = 1;
+  
+    /* initialize SR specific variables */
+    rcv->rcv_base = 0;
+    rcv->reassembled = 0;
+    rcv->buffered = 0;
+    rcv->received = 0;
+    for (i = 0; i < RCVSLOTS; i++) {
+      rcv->buffer_status[i] = 0;
+      rcv->nak_at[i] = 0;
+    }
+  }
+}
+
+/******************************************************************************
+ * The following functions need be completed only for bi-directional messages *
+ *****************************************************************************/
+
+/* Note that with simplex transfer from a-to-B, there is no B_output() */
+void B_output(int conn, struct msg message)  
+{
+}
+
+/* called when B's timer goes off */
+void B_timerinterrupt(int conn)
+{
+}
+
+/* checkpoints: the state of every connection, written as it is in memory */
+void save_state(FILE *f)
+{
+  fwrite(senders, sizeof(struct sender), nsenders, f);
+  fwrite(receivers, sizeof(struct receiver), nreceivers, f);
+}
+
+int restore_state(FILE *f)
+{
+  if (fread(senders, sizeof(struct sender), nsenders, f) != (size_t)nsenders
+      || fread(receivers, sizeof(struct receiver), nreceivers, f) != (size_t)nreceivers)
+    return -1;
+  return 0;
+}
@@ -1,11 +1,20 @@
-extern void A_init(void);
-extern void B_init(void);
-extern void A_input(struct pkt);
-extern void B_input(struct pkt);
-extern void A_output(struct msg);
-extern void A_timerinterrupt(void);
-
-/* included for extension to bidirectional communication */
-#define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
-extern void B_output(struct msg);
-extern void B_timerinterrupt(void);
\ No newline at end of file
+/* The protocol keeps a separate state for each connection.  A_init and  */
+/* B_init are told how many connections there are; every other entry     */
+/* point is given the connection the event belongs to.                   */
+extern void A_init(int);
+extern void B_init(int);
+extern void A_input(int, struct pkt);
+extern void B_input(int, struct pkt);
+extern void A_output(int, struct msg);
+extern void A_timerinterrupt(int);
+
+/* included for extension to bidirectional communication */
+#define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
+extern void B_output(int, struct msg);
+extern void B_timerinterrupt(int);
+
+/* Checkpoints (-C, -L): write the state of every connection, and read it */
+/* back after A_init/B_init were called with the same number; restore    */
+/* returns 0 when it got all of it.                                       */
+extern void save_state(FILE *);
+extern int restore_state(FILE *);
\ No newline at end of file
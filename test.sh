@@ -12,9 +12,10 @@ echo -e "${GREEN}Starting Selective Repeat Protocol Tests${NC}\n"
 run_test() {
     test_name=$1
     test_input=$2
+    test_args=$3
     
     echo -e "${YELLOW}Running $test_name...${NC}"
-    echo "$test_input" | ./sr > test_output.txt 2>&1
+    echo "$test_input" | ./sr $test_args > test_output.txt 2>&1
     
     # Check for errors
     if grep -q "panic\|error\|fault" test_output.txt; then
@@ -25,7 +26,7 @@ run_test() {
         
         # Show summary statistics
         echo "Statistics:"
-        grep -E "number of valid|number of packet resends|number of correct packets|number of messages delivered" test_output.txt
+        grep -E "number of valid|number of packet resends|number of correct packets|number of messages delivered|number of bytes delivered|out of order|receive buffer|lost in the channel|burst lengths|replay records|fairness|FEC|recovered|switches|telemetry|confidence|stopped|file source|matches the file|MISMATCH|verified goodput|NAK|advertised|probes|waiting to be read|traffic generator|goodput \(bytes per sim|statistics cover|horizon|routers" test_output.txt
     fi
     
     # Save full output for later review
@@ -35,7 +36,7 @@ run_test() {
 
 # First, compile the program
 echo -e "${YELLOW}Compiling sr.c...${NC}"
-gcc -Wall -ansi -pedantic -o sr emulator.c sr.c
+gcc -Wall -ansi -pedantic -o sr emulator.c sr.c -lm
 if [ $? -ne 0 ]; then
     echo -e "${RED}Compilation failed! Please fix errors before testing.${NC}"
     exit 1
@@ -105,6 +106,301 @@ run_test "Test9_Seq_Wraparound" "20
 1
 1"
 
+# Test 10: Messages larger than the MTU are segmented and reassembled
+run_test "Test10_Segmentation" "10
+0.0
+0.0
+20
+2" "-m 8 -s 20"
+
+# Test 11: Reordering channel exercises the receive buffer
+run_test "Test11_Reordering" "50
+0.1
+0.0
+0
+5
+1" "-r 0.3 -J exponential -j 5"
+
+# Test 12: Bursty Gilbert-Elliott losses
+run_test "Test12_Burst_Loss" "100
+0.01
+0.0
+2
+10
+1" "-G 0.05,0.3,0.7"
+
+# Test 13: Replay the channel from a file (every 5th packet lost, fixed delay)
+gcc -Wall -ansi -pedantic -o mkreplay mkreplay.c
+for i in $(seq 1 40); do
+    if [ $((i % 5)) -eq 0 ]; then echo "1 0 -1"; else echo "0 0 4.0"; fi
+done | ./mkreplay > Test13_channel.rpl 2>/dev/null
+run_test "Test13_Replay" "20
+0.0
+0.0
+2
+10
+1" "-T Test13_channel.rpl,loop"
+
+# Test 14: Several connections sharing the channel
+run_test "Test14_Multi_Flow" "80
+0.1
+0.0
+2
+200
+1" "-n 8"
+
+# Test 15: XOR parity lets B rebuild a lost packet without a timeout
+run_test "Test15_FEC" "200
+0.05
+0.0
+2
+4
+1" "-F 3"
+
+# Test 16: Adaptive sender switching between GBN and SR style resends
+run_test "Test16_Adaptive" "300
+0.2
+0.0
+2
+10
+1" "-R adaptive"
+
+# Test 17: The same protocol over real UDP sockets on the loopback interface
+echo -e "${YELLOW}Running Test17_UDP_Loopback...${NC}"
+gcc -Wall -ansi -pedantic -O2 -o sr_udp udp.c sr.c
+if ./sr_udp -N 20000 -l 0.01 -w 20 > Test17_UDP_Loopback.txt 2>&1; then
+    echo -e "${GREEN}✓ Test17_UDP_Loopback completed${NC}"
+    echo "Statistics:"
+    grep -E "messages delivered|per second|per packet" Test17_UDP_Loopback.txt
+else
+    echo -e "${RED}❌ Test17_UDP_Loopback failed${NC}"
+    cat Test17_UDP_Loopback.txt
+fi
+echo ""
+
+# Test 18: A and B on their own threads, talking through rings
+echo -e "${YELLOW}Running Test18_Real_Time...${NC}"
+gcc -Wall -ansi -pedantic -O2 -pthread -o sr_rt realtime.c sr.c
+if ./sr_rt -N 20000 -l 0.01 -d 10 -j 10 -w 20 > Test18_Real_Time.txt 2>&1; then
+    echo -e "${GREEN}✓ Test18_Real_Time completed${NC}"
+    echo "Statistics:"
+    grep -E "messages delivered|per second|latency" Test18_Real_Time.txt
+else
+    echo -e "${RED}❌ Test18_Real_Time failed${NC}"
+    cat Test18_Real_Time.txt
+fi
+echo ""
+
+# Test 19: Per function costs from the instrumented build
+echo -e "${YELLOW}Running Test19_Profile...${NC}"
+gcc -Wall -ansi -pedantic -O2 -DPROFILE -o sr_prof emulator.c sr.c -lm
+if printf "500\n0.1\n0.1\n2\n10\n0\n" | ./sr_prof > Test19_Profile.txt 2>&1 \
+   && grep -q "hot path profile" Test19_Profile.txt; then
+    echo -e "${GREEN}✓ Test19_Profile completed${NC}"
+    sed -n '/hot path profile/,$p' Test19_Profile.txt
+else
+    echo -e "${RED}❌ Test19_Profile failed${NC}"
+    tail Test19_Profile.txt
+fi
+echo ""
+
+# Test 20: Time series of the event queue and windows
+run_test "Test20_Telemetry" "300
+0.1
+0.1
+2
+10
+1" "-S Test20_Telemetry.csv,20t"
+
+# Test 21: A run resumed from a checkpoint ends exactly like the uninterrupted one
+echo -e "${YELLOW}Running Test21_Checkpoint...${NC}"
+input="500\n0.1\n0.1\n2\n10\n0\n"
+report() { sed -n 's/.*Simulator terminated/Simulator terminated/; /terminated/,$p' "$1" | grep -v "CPU second"; }
+printf "$input" | ./sr > Test21_full.txt 2>&1
+printf "$input" | ./sr -C Test21.snap,2000 > Test21_Checkpoint.txt 2>&1
+printf "$input" | ./sr -L Test21.snap > Test21_resumed.txt 2>&1
+if grep -q "checkpoint saved" Test21_Checkpoint.txt \
+   && diff <(report Test21_full.txt) <(report Test21_resumed.txt) > /dev/null; then
+    echo -e "${GREEN}✓ Test21_Checkpoint completed${NC}"
+    echo "Statistics:"
+    grep -ohE "(checkpoint saved|resumed from).*" Test21_Checkpoint.txt Test21_resumed.txt
+    grep -E "messages delivered" Test21_resumed.txt
+else
+    echo -e "${RED}❌ Test21_Checkpoint failed${NC}"
+    diff <(report Test21_full.txt) <(report Test21_resumed.txt)
+fi
+echo ""
+
+# Test 22: Stop as soon as goodput is known to within 5%
+run_test "Test22_Early_Stop" "100000
+0.1
+0.1
+2
+10
+0" "-E goodput,0.05 -X 200000"
+
+# Test 23: -t 2 reports exactly what the emulator's own sequential run does with -i
+echo -e "${YELLOW}Running Test23_Parallel...${NC}"
+gcc -Wall -ansi -pedantic -O2 -pthread -DPARALLEL -o sr_par emulator.c sr.c -lm
+input="3000\n0.1\n0.1\n2\n10\n0\n"
+args="-n 2 -r 0.1 -G 0.02,0.3,0.6 -U 500 -A exponential -D 4"
+printf "$input" | ./sr -i $args > Test23_sequential.txt 2>&1
+printf "$input" | ./sr_par -t 2 $args > Test23_Parallel.txt 2>&1
+if diff <(grep -v "CPU second" Test23_sequential.txt) \
+        <(grep -v "CPU second\|synchronisation" Test23_Parallel.txt) > /dev/null; then
+    echo -e "${GREEN}✓ Test23_Parallel completed${NC}"
+    echo "Statistics:"
+    grep -E "messages delivered|synchronisation" Test23_Parallel.txt
+else
+    echo -e "${RED}❌ Test23_Parallel failed${NC}"
+    diff Test23_sequential.txt Test23_Parallel.txt
+fi
+echo ""
+
+# Test 24: Window size specialised builds behave like the runtime sized one
+echo -e "${YELLOW}Running Test24_Specialised...${NC}"
+for w in 4 6 8 16 32; do
+    gcc -Wall -ansi -pedantic -c -O2 -DNTRACE -DWINDOWSIZE=$w -DENGINE=w$w -o sr_w$w.o sr.c
+done
+gcc -Wall -ansi -pedantic -c -O2 -DRUNTIME_WINDOW -DENGINE=wn -o sr_wn.o sr.c
+gcc -Wall -ansi -pedantic -O2 -DENGINES -o sr_fast emulator.c engines.c sr_w*.o -lm
+gcc -Wall -ansi -pedantic -O2 -DRUNTIME_WINDOW -o sr_generic emulator.c sr.c -lm
+input="2000\n0.1\n0.1\n2\n10\n0\n"
+printf "$input" | ./sr_fast -W 8 > Test24_Specialised.txt 2>&1
+printf "$input" | ./sr_generic -W 8 > Test24_generic.txt 2>&1
+if diff <(grep -v "CPU second" Test24_Specialised.txt) <(grep -v "CPU second" Test24_generic.txt) > /dev/null \
+   && grep -q "messages delivered" Test24_Specialised.txt; then
+    echo -e "${GREEN}✓ Test24_Specialised completed${NC}"
+    echo "Statistics:"
+    grep -E "messages delivered|CPU second" Test24_Specialised.txt Test24_generic.txt
+else
+    echo -e "${RED}❌ Test24_Specialised failed${NC}"
+    diff Test24_Specialised.txt Test24_generic.txt
+fi
+echo ""
+
+# Test 25: Send a real file and check what B delivers against it
+seq 1 20000 > Test25_source.txt
+run_test "Test25_File_Source" "500
+0.1
+0.1
+2
+20
+0" "-I Test25_source.txt -s 300 -m 128"
+
+# Test 26: Write what B delivers to a file and compare it with the source
+echo -e "${YELLOW}Running Test26_Output_Sink...${NC}"
+printf "200\n0.1\n0.1\n2\n20\n0\n" | ./sr -I Test25_source.txt -O Test26_received.txt -s 300 -m 128 > Test26_Output_Sink.txt 2>&1
+if grep -q "written to Test26_received.txt" Test26_Output_Sink.txt \
+   && cmp Test26_received.txt <(head -c "$(stat -c %s Test26_received.txt)" Test25_source.txt); then
+    echo -e "${GREEN}✓ Test26_Output_Sink completed${NC}"
+    echo "Statistics:"
+    grep -E "number of bytes delivered|written to" Test26_Output_Sink.txt
+else
+    echo -e "${RED}❌ Test26_Output_Sink failed${NC}"
+    tail Test26_Output_Sink.txt
+fi
+echo ""
+
+# Test 27: B NAKs gaps and A resends them without waiting for the timer
+run_test "Test27_NAK" "2000
+0.2
+0.1
+2
+5
+0" "-K 3 -I Test25_source.txt -s 50"
+
+# Test 28: B's application reads slowly and A keeps to B's advertised window
+run_test "Test28_Flow_Control" "2000
+0.1
+0.1
+2
+5
+0" "-D 0.5 -I Test25_source.txt -s 20 -m 20"
+
+# Test 29: An always backlogged sender finds the protocol's peak throughput
+run_test "Test29_Saturate" "1000
+0.1
+0.1
+2
+5
+0" "-A saturate -I Test25_source.txt -s 20"
+
+# Test 30: Steady state only: no warm-up, no drain
+run_test "Test30_Steady_State" "1000000
+0.1
+0.1
+2
+5
+0" "-U 500 -H 5000"
+
+# Test 31: Statistics shared through a mapped file, read by livestats
+echo -e "${YELLOW}Running Test31_Live...${NC}"
+gcc -Wall -ansi -pedantic -o livestats livestats.c
+printf "2000\n0.1\n0.1\n2\n5\n0\n" | ./sr -M Test31.live > Test31_Live.txt 2>&1
+./livestats Test31.live 0 > Test31_livestats.txt 2>&1
+delivered=$(grep -o "delivered to application:  [0-9]*" Test31_Live.txt | grep -o "[0-9]*$")
+if grep -q "delivered $delivered .*(run finished)" Test31_livestats.txt; then
+    echo -e "${GREEN}✓ Test31_Live completed${NC}"
+    cat Test31_livestats.txt
+else
+    echo -e "${RED}❌ Test31_Live failed${NC}"
+    cat Test31_livestats.txt
+fi
+echo ""
+
+# Test 32: Three routers between A and B, a lossy one and a slow one
+run_test "Test32_Routers" "1000
+0.1
+0.1
+2
+5
+0" "-P 1,0.05,16,0.5:1,0,3,2:1,0,16,0.5 -I Test25_source.txt -s 20"
+
+# Test 33: A timer per packet through starttimer_id(), data checked at B
+echo -e "${YELLOW}Running Test33_Packet_Timers...${NC}"
+gcc -Wall -ansi -pedantic -O2 -DPACKET_TIMERS -o sr_pt emulator.c sr.c -lm
+printf "2000\n0.2\n0.1\n2\n5\n0\n" | ./sr_pt -K 3 -I Test25_source.txt -s 50 > Test33_Packet_Timers.txt 2>&1
+if grep -q "verified" Test33_Packet_Timers.txt && ! grep -q "Warning\|MISMATCH" Test33_Packet_Timers.txt; then
+    echo -e "${GREEN}✓ Test33_Packet_Timers completed${NC}"
+    echo "Statistics:"
+    grep -E "number of packet resends|messages delivered|file source" Test33_Packet_Timers.txt
+else
+    echo -e "${RED}❌ Test33_Packet_Timers failed${NC}"
+    tail Test33_Packet_Timers.txt
+fi
+echo ""
+
+# Test 34: Packets that overtake others still deliver exactly the file
+echo -e "${YELLOW}Running Test34_Reorder_Data...${NC}"
+printf "3000\n0.1\n0.1\n2\n2\n0\n" | ./sr -r 0.1 -j 2 -K 2 -I Test25_source.txt > Test34_Reorder_Data.txt 2>&1
+if grep -q "bytes accepted by A, \([0-9]*\) delivered, \1 verified" Test34_Reorder_Data.txt \
+   && ! grep -q "MISMATCH" Test34_Reorder_Data.txt; then
+    echo -e "${GREEN}✓ Test34_Reorder_Data completed${NC}"
+    echo "Statistics:"
+    grep -E "out of order|longer than|file source" Test34_Reorder_Data.txt
+else
+    echo -e "${RED}❌ Test34_Reorder_Data failed${NC}"
+    tail Test34_Reorder_Data.txt
+fi
+echo ""
+
+# Test 35: gbn.c delivers the file too, over a lossy and a reordering channel
+echo -e "${YELLOW}Running Test35_GBN_Data...${NC}"
+gcc -Wall -ansi -pedantic -O2 -o gbn emulator.c gbn.c -lm 2> /dev/null
+printf "3000\n0.1\n0.1\n2\n2\n0\n" | ./gbn -I Test25_source.txt > Test35_GBN_Data.txt 2>&1
+printf "3000\n0.1\n0.1\n2\n2\n0\n" | ./gbn -r 0.1 -j 2 -I Test25_source.txt >> Test35_GBN_Data.txt 2>&1
+if [ "$(grep -c "bytes accepted by A, \([0-9]*\) delivered, \1 verified" Test35_GBN_Data.txt)" = 2 ] \
+   && ! grep -q "MISMATCH" Test35_GBN_Data.txt; then
+    echo -e "${GREEN}✓ Test35_GBN_Data completed${NC}"
+    echo "Statistics:"
+    grep -E "file source" Test35_GBN_Data.txt
+else
+    echo -e "${RED}❌ Test35_GBN_Data failed${NC}"
+    grep -E "file source|MISMATCH" Test35_GBN_Data.txt
+fi
+echo ""
+
 echo -e "${GREEN}All tests completed!${NC}"
 echo -e "\nTest outputs saved as: Test*.txt"
 echo -e "\nReview the full outputs for detailed protocol behavior."
\ No newline at end of file
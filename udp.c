@@ -0,0 +1,501 @@
+/* ******************************************************************
+   UDP LOOPBACK BACKEND
+
+   Runs the same A and B entities (sr.c or gbn.c) over real UDP sockets
+   on 127.0.0.1 instead of the discrete event emulator, so that the real
+   CPU cost of the protocol code per packet can be measured:
+
+     gcc -Wall -ansi -pedantic -O2 -o sr_udp udp.c sr.c
+     ./sr_udp -N 1000000 -l 0.01
+
+   Both entities live in one thread of one process:
+   - each entity has its own socket, connected to the other one,
+   - packets handed to tolayer3() are queued and sent in batches with
+     sendmmsg(), and arrivals are read in batches with recvmmsg(),
+   - every (entity, connection) timer is a timerfd, and a single epoll
+     set waits for sockets and timers together,
+   - loss is injected in software in tolayer3() (-l).
+   One time unit of the protocol (RTT is 16 of them) is -u microseconds.
+
+   Layer 5 keeps A busy: messages are offered to A_output() until its
+   window is full, and a refused message is offered again later.  The
+   run ends when all -N messages have been delivered to B's layer 5.
+**********************************************************************/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include "emulator.h"
+#include "sr.h"
+
+#define BATCH   64         /* packets per sendmmsg()/recvmmsg() */
+#define MAXEV   64         /* epoll events taken per wait */
+
+/* a packet on the wire: the connection it belongs to, then the pkt */
+/* header and the bytes of payload in use */
+#define WIRE_MAX (sizeof(int) + sizeof(struct pkt))
+
+int TRACE = 0;
+int mtu = MAXPAYLOAD;
+int msgsize = 20;
+int fec_k = 0;
+int retx_mode = RETX_SR;
+int window_size;
+int nak_holdoff;
+int flow_control;
+
+/* statistics updated by the protocol */
+int window_full;
+int rcv_buffer_max;
+int total_ACKs_received;
+int packets_resent;
+int new_ACKs;
+int packets_received;
+int fec_recovered;
+int retx_recovered;
+int mode_switches;
+int unacked_packets;
+int buffered_packets;
+int naks_sent;
+int nak_resends;
+int timeout_resends;
+int flow_limited;
+int window_probes;
+
+/* run parameters */
+static int nsimmax = 100000;       /* messages to deliver, -N */
+static int nflows = 1;             /* connections, -n */
+static double lossprob;            /* software loss, -l */
+static long usecperunit = 100;     /* microseconds per protocol time unit, -u */
+static int cpu = -1;               /* core to pin the process to, -c */
+static double maxseconds = 60.0;   /* give up after this long, -w */
+
+/* sockets and timers */
+static int sock[2];                /* A's and B's socket */
+static int epfd;
+static int *timerfds;              /* 2 per connection: A's then B's */
+static char *timerarmed;
+
+/* outgoing batches, one per entity */
+static char outbuf[2][BATCH][WIRE_MAX];
+static struct iovec outiov[2][BATCH];
+static struct mmsghdr outmsg[2][BATCH];
+static int nout[2];
+
+/* incoming batch */
+static char inbuf[BATCH][WIRE_MAX];
+static struct iovec iniov[BATCH];
+static struct mmsghdr inmsg[BATCH];
+
+/* counters of the backend itself */
+static int nsim;                   /* messages accepted by A_output() */
+static int refused;                /* offers refused because the window was full */
+static int delivered;              /* messages given to tolayer5() */
+static unsigned long bytes_delivered;
+static unsigned long pktssent;     /* packets that went out on a socket */
+static unsigned long pktslost;     /* dropped by the software loss */
+static unsigned long kerneldrops;  /* refused by a full socket buffer */
+static unsigned long nsendcalls, nrecvcalls, ntimercalls;
+static double protosecs;           /* time spent inside the protocol code */
+
+/* wall clock in seconds */
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fail(char *what)
+{
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+/* fast generator for the software loss, so that drawing costs nothing */
+static unsigned long lossrand = 9999;
+static double lossdraw(void)
+{
+  lossrand ^= lossrand << 13;
+  lossrand ^= lossrand >> 7;
+  lossrand ^= lossrand << 17;
+  return (lossrand & 0xffffff) / (double)0x1000000;
+}
+
+/* send everything queued by entity AorB in as few calls as possible */
+static void flush(int AorB)
+{
+  int done = 0, n;
+
+  while (done < nout[AorB]) {
+    n = sendmmsg(sock[AorB], &outmsg[AorB][done], nout[AorB] - done, 0);
+    nsendcalls++;
+    if (n < 0) {
+      if (errno == EAGAIN || errno == ENOBUFS) {
+        /* the receiving socket is full; the rest is lost, as on a real link */
+        kerneldrops += nout[AorB] - done;
+        break;
+      }
+      fail("sendmmsg");
+    }
+    done += n;
+    pktssent += n;
+  }
+  nout[AorB] = 0;
+}
+
+/********************** routines called by the protocol *****************/
+
+void tolayer3(int AorB, int conn, struct pkt packet)
+{
+  char *p;
+
+  if (lossprob > 0.0 && lossdraw() < lossprob) {
+    pktslost++;
+    return;
+  }
+  p = outbuf[AorB][nout[AorB]];
+  memcpy(p, &conn, sizeof(int));
+  memcpy(p + sizeof(int), &packet, PKT_USED(packet));
+  outiov[AorB][nout[AorB]].iov_len = sizeof(int) + PKT_USED(packet);
+  if (++nout[AorB] == BATCH)
+    flush(AorB);
+}
+
+void tolayer5(int AorB, int conn, char *datasent, int length)
+{
+  delivered++;
+  bytes_delivered += length;
+}
+
+/* layer 5 here reads everything as soon as it is delivered */
+int layer5_unread(int AorB, int conn)
+{
+  return 0;
+}
+
+void starttimer(int AorB, int conn, double increment)
+{
+  struct itimerspec its;
+  long usec = (long)(increment * usecperunit);
+
+  if (timerarmed[2 * conn + AorB]) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = usec / 1000000;
+  its.it_value.tv_nsec = (usec % 1000000) * 1000;
+  if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+    its.it_value.tv_nsec = 1;
+  if (timerfd_settime(timerfds[2 * conn + AorB], 0, &its, NULL) < 0)
+    fail("timerfd_settime");
+  ntimercalls++;
+  timerarmed[2 * conn + AorB] = 1;
+}
+
+void stoptimer(int AorB, int conn)
+{
+  struct itimerspec its;
+
+  if (!timerarmed[2 * conn + AorB]) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  memset(&its, 0, sizeof(its));
+  if (timerfd_settime(timerfds[2 * conn + AorB], 0, &its, NULL) < 0)
+    fail("timerfd_settime");
+  ntimercalls++;
+  timerarmed[2 * conn + AorB] = 0;
+}
+
+/****************************** the backend *****************************/
+
+static void usage(char *prog)
+{
+  printf("usage: %s [-N msgs] [-s msgsize] [-m mtu] [-n flows] [-F k] [-R mode]\n"
+         "       [-K holdoff] [-l lossprob] [-u usec] [-c cpu] [-w seconds] [-t trace]\n", prog);
+  printf("  -N msgs     messages to deliver (default 100000)\n");
+  printf("  -s msgsize  bytes per message (default 20)\n");
+  printf("  -m mtu      payload bytes per packet (default %d)\n", MAXPAYLOAD);
+  printf("  -n flows    connections between A and B (default 1)\n");
+  printf("  -F k        one XOR parity packet per k data packets (sr.c only)\n");
+  printf("  -R mode     resend after a timeout: sr, gbn or adaptive (sr.c only)\n");
+  printf("  -K holdoff  B NAKs gaps, again after holdoff more packets (sr.c only)\n");
+  printf("  -l prob     probability that tolayer3() drops a packet (default 0)\n");
+  printf("  -u usec     microseconds per protocol time unit (default 100)\n");
+  printf("  -c cpu      pin the process to this core\n");
+  printf("  -w seconds  give up after this long (default 60)\n");
+  printf("  -t trace    protocol TRACE level (default 0)\n");
+  exit(EXIT_FAILURE);
+}
+
+static void parseargs(int argc, char **argv)
+{
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (i + 1 >= argc)
+      usage(argv[0]);
+    if (strcmp(argv[i], "-N") == 0)
+      nsimmax = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0)
+      msgsize = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-m") == 0)
+      mtu = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-n") == 0)
+      nflows = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-F") == 0)
+      fec_k = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-K") == 0)
+      nak_holdoff = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-R") == 0) {
+      i++;
+      if (strcmp(argv[i], "sr") == 0)
+        retx_mode = RETX_SR;
+      else if (strcmp(argv[i], "gbn") == 0)
+        retx_mode = RETX_GBN;
+      else if (strcmp(argv[i], "adaptive") == 0)
+        retx_mode = RETX_ADAPTIVE;
+      else
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-l") == 0)
+      lossprob = atof(argv[++i]);
+    else if (strcmp(argv[i], "-u") == 0)
+      usecperunit = atol(argv[++i]);
+    else if (strcmp(argv[i], "-c") == 0)
+      cpu = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-w") == 0)
+      maxseconds = atof(argv[++i]);
+    else if (strcmp(argv[i], "-t") == 0)
+      TRACE = atoi(argv[++i]);
+    else
+      usage(argv[0]);
+  }
+  if (nsimmax < 1 || msgsize < 1 || msgsize > MAXMSG || mtu < 1 || mtu > MAXPAYLOAD
+      || nflows < 1 || fec_k < 0 || nak_holdoff < 0 || lossprob < 0.0 || lossprob >= 1.0 || usecperunit < 1)
+    usage(argv[0]);
+}
+
+static void setup(void)
+{
+  struct sockaddr_in addr[2];
+  socklen_t len;
+  struct epoll_event ev;
+  int e, i, bufsize = 4 << 20;
+
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+      fail("sched_setaffinity");
+  }
+
+  if ((epfd = epoll_create1(0)) < 0)
+    fail("epoll_create1");
+
+  for (e = A; e <= B; e++) {
+    sock[e] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (sock[e] < 0)
+      fail("socket");
+    setsockopt(sock[e], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    setsockopt(sock[e], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    memset(&addr[e], 0, sizeof(addr[e]));
+    addr[e].sin_family = AF_INET;
+    addr[e].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock[e], (struct sockaddr *)&addr[e], sizeof(addr[e])) < 0)
+      fail("bind");
+    len = sizeof(addr[e]);
+    getsockname(sock[e], (struct sockaddr *)&addr[e], &len);
+  }
+  for (e = A; e <= B; e++) {
+    if (connect(sock[e], (struct sockaddr *)&addr[1 - e], sizeof(addr[e])) < 0)
+      fail("connect");
+    ev.events = EPOLLIN;
+    ev.data.u32 = e;                     /* sockets are 0 and 1 ... */
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock[e], &ev) < 0)
+      fail("epoll_ctl");
+    for (i = 0; i < BATCH; i++) {
+      outiov[e][i].iov_base = outbuf[e][i];
+      outmsg[e][i].msg_hdr.msg_iov = &outiov[e][i];
+      outmsg[e][i].msg_hdr.msg_iovlen = 1;
+    }
+  }
+  for (i = 0; i < BATCH; i++) {
+    iniov[i].iov_base = inbuf[i];
+    iniov[i].iov_len = WIRE_MAX;
+    inmsg[i].msg_hdr.msg_iov = &iniov[i];
+    inmsg[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  timerfds = malloc(2 * nflows * sizeof(int));
+  timerarmed = calloc(2 * nflows, 1);
+  if (timerfds == NULL || timerarmed == NULL)
+    fail("malloc");
+  for (i = 0; i < 2 * nflows; i++) {
+    timerfds[i] = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerfds[i] < 0)
+      fail("timerfd_create");
+    ev.events = EPOLLIN;
+    ev.data.u32 = 2 + i;                 /* ... timers come after them */
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, timerfds[i], &ev) < 0)
+      fail("epoll_ctl");
+  }
+}
+
+/* read everything waiting on entity e's socket and hand it to e */
+static void receive(int e)
+{
+  static struct pkt packet;
+  int n, i, conn;
+  double t;
+
+  do {
+    for (i = 0; i < BATCH; i++)
+      inmsg[i].msg_hdr.msg_flags = 0;
+    n = recvmmsg(sock[e], inmsg, BATCH, MSG_DONTWAIT, NULL);
+    nrecvcalls++;
+    if (n < 0) {
+      if (errno == EAGAIN)
+        return;
+      fail("recvmmsg");
+    }
+    t = now();
+    for (i = 0; i < n; i++) {
+      if (inmsg[i].msg_len < sizeof(int) + PKT_HDRLEN)
+        continue;
+      memcpy(&conn, inbuf[i], sizeof(int));
+      memcpy(&packet, inbuf[i] + sizeof(int), inmsg[i].msg_len - sizeof(int));
+      if (conn < 0 || conn >= nflows)
+        continue;
+      if (e == A)
+        A_input(conn, packet);
+      else
+        B_input(conn, packet);
+    }
+    protosecs += now() - t;
+  } while (n == BATCH);
+}
+
+/* a timer fired: tell its entity, unless it was stopped in the meantime */
+static void expire(int i)
+{
+  uint64_t ticks;
+  int conn = i / 2, e = i % 2;
+  double t;
+
+  if (read(timerfds[i], &ticks, sizeof(ticks)) != sizeof(ticks) || !timerarmed[i])
+    return;
+  timerarmed[i] = 0;
+  t = now();
+  if (e == A)
+    A_timerinterrupt(conn);
+  else
+    B_timerinterrupt(conn);
+  protosecs += now() - t;
+}
+
+/* keep every connection's sender busy until all messages are accepted */
+static void feed(void)
+{
+  static struct msg message;
+  static int conn;
+  int tries, before;
+  double t;
+
+  t = now();
+  for (tries = 0; tries < nflows && nsim < nsimmax; tries++) {
+    message.length = msgsize;
+    memset(message.data, 'a' + nsim % 26, msgsize);
+    before = window_full;
+    A_output(conn, message);
+    if (window_full != before)
+      refused++;           /* try this message again next time round */
+    else {
+      nsim++;
+      tries = -1;          /* the same connection may take more */
+      continue;
+    }
+    conn = (conn + 1) % nflows;
+  }
+  protosecs += now() - t;
+}
+
+int main(int argc, char **argv)
+{
+  struct epoll_event evs[MAXEV];
+  struct rusage ru;
+  double started, elapsed, cpusecs;
+  int n, i;
+  unsigned long pkts;
+
+  parseargs(argc, argv);
+  setup();
+  A_init(nflows);
+  B_init(nflows);
+
+  started = now();
+  while (delivered < nsimmax) {
+    feed();
+    flush(A);
+    flush(B);
+    if (now() - started > maxseconds) {
+      printf("giving up after %.0f seconds\n", maxseconds);
+      break;
+    }
+    n = epoll_wait(epfd, evs, MAXEV, 100);
+    if (n < 0 && errno != EINTR)
+      fail("epoll_wait");
+    for (i = 0; i < n; i++) {
+      if (evs[i].data.u32 < 2)
+        receive(evs[i].data.u32);
+      else
+        expire(evs[i].data.u32 - 2);
+    }
+  }
+  elapsed = now() - started;
+  getrusage(RUSAGE_SELF, &ru);
+  cpusecs = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+    + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+  pkts = pktssent > 0 ? pktssent : 1;
+
+  printf("UDP loopback run: %d connections, %d byte messages, mtu %d, loss %f%s\n",
+         nflows, msgsize, mtu, lossprob, cpu >= 0 ? ", pinned" : "");
+  printf("number of messages delivered to application:  %d in %f seconds\n", delivered, elapsed);
+  printf("number of bytes delivered to application:  %lu \n", bytes_delivered);
+  printf("number of packets sent over UDP:  %lu (lost in software %lu, by the kernel %lu)\n",
+         pktssent, pktslost, kerneldrops);
+  printf("number of packet resends by A:  %d \n", packets_resent);
+  if (retx_mode == RETX_ADAPTIVE)
+    printf("number of switches between GBN and SR retransmission:  %d \n", mode_switches);
+  if (nak_holdoff > 0)
+    printf("number of packet resends by A after a NAK:  %d, after a timeout:  %d \n",
+           nak_resends, timeout_resends);
+  if (fec_k > 0) {
+    printf("number of packets recovered by FEC at B:  %d \n", fec_recovered);
+    printf("number of packets recovered by retransmission at B:  %d \n", retx_recovered);
+  }
+  printf("number of offers refused by a full window:  %d \n", refused);
+  printf("messages per second:  %.0f \n", delivered / elapsed);
+  printf("packets per second:  %.0f \n", pktssent / elapsed);
+  printf("goodput (bytes per second):  %.0f \n", bytes_delivered / elapsed);
+  printf("CPU time per packet:  %.3f us (of which protocol code %.3f us)\n",
+         cpusecs * 1e6 / pkts, protosecs * 1e6 / pkts);
+  printf("system calls per packet:  sendmmsg %.3f, recvmmsg %.3f, timerfd %.3f\n",
+         (double)nsendcalls / pkts, (double)nrecvcalls / pkts, (double)ntimercalls / pkts);
+  return delivered == nsimmax ? EXIT_SUCCESS : EXIT_FAILURE;
+}